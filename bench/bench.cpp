@@ -0,0 +1,1038 @@
+// Performance suite for every public image operation, in the style of Google
+// Benchmark, plus golden-output checks against sample_io/.
+//
+//     bench [--filter TEXT] [--sizes 256,1024] [--kernels 3,41] [--min-time SECONDS]
+//           [--json FILE] [--golden-dir DIR] [--goldens-only] [--no-goldens]
+//
+// The goldens run first; if any of them fails the benchmarks still run, but the
+// exit status is 1, so a speedup that changes results cannot go unnoticed.
+
+#include "BufferPool.h"
+#include "ColorImage.h"
+#include "Crypto.h"
+#include "Filter.h"
+#include "FilterPipeline.h"
+#include "GrayscaleImage.h"
+#include "ImageCompare.h"
+#include "ImagePyramid.h"
+#include "IncrementalFilter.h"
+#include "PixelOps.h"
+#include "ResultCache.h"
+#include "SecretImage.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// ---------------------------------------------------------------------------
+// Harness
+
+// Handed to each benchmark body, which repeats the measured work while
+// keep_running() returns true. Setup before the loop is not timed.
+class BenchState {
+private:
+    long iterations;
+    long remaining;
+    bool started;
+    std::chrono::steady_clock::time_point realStart;
+    std::clock_t cpuStart;
+    double realSeconds;
+    double cpuSeconds;
+    double bytesProcessed;
+
+public:
+    explicit BenchState(long iterations)
+        : iterations(iterations), remaining(iterations), started(false), cpuStart(0),
+          realSeconds(0), cpuSeconds(0), bytesProcessed(0) {}
+
+    bool keep_running() {
+        if (!started) {
+            started = true;
+            realStart = std::chrono::steady_clock::now();
+            cpuStart = std::clock();
+        }
+        if (remaining == 0) {
+            realSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - realStart).count();
+            cpuSeconds = (double) (std::clock() - cpuStart) / CLOCKS_PER_SEC;
+            return false;
+        }
+        remaining--;
+        return true;
+    }
+
+    long get_iterations() const { return iterations; }
+    double get_real_seconds() const { return realSeconds; }
+    double get_cpu_seconds() const { return cpuSeconds; }
+
+    // Bytes touched by one iteration, reported as throughput.
+    void set_bytes_per_iteration(double bytes) { bytesProcessed = bytes; }
+    double get_bytes_per_iteration() const { return bytesProcessed; }
+};
+
+struct Benchmark {
+    std::string name;
+    std::function<void(BenchState&)> body;
+};
+
+struct BenchRun {
+    std::string name;
+    long iterations;
+    double realNanoseconds;   // Per iteration
+    double cpuNanoseconds;    // Per iteration, summed over all threads
+    double bytesPerSecond;
+};
+
+// Runs the body with a growing iteration count until one run lasts minTime.
+static BenchRun run_benchmark(const Benchmark& benchmark, double minTime) {
+    long iterations = 1;
+    while (true) {
+        BenchState state(iterations);
+        benchmark.body(state);
+        double elapsed = state.get_real_seconds();
+        if (elapsed >= minTime || iterations >= 1000000000L) {
+            BenchRun run;
+            run.name = benchmark.name;
+            run.iterations = iterations;
+            run.realNanoseconds = elapsed * 1e9 / iterations;
+            run.cpuNanoseconds = state.get_cpu_seconds() * 1e9 / iterations;
+            run.bytesPerSecond = elapsed > 0 ? state.get_bytes_per_iteration() * iterations / elapsed : 0;
+            return run;
+        }
+        // Aim 40% past the target, growing at most tenfold per attempt.
+        double multiplier = elapsed > 0 ? minTime * 1.4 / elapsed : 10.0;
+        multiplier = multiplier > 10.0 ? 10.0 : multiplier;
+        long next = (long) (iterations * multiplier);
+        iterations = next > iterations ? next : iterations + 1;
+    }
+}
+
+struct GoldenResult {
+    std::string name;
+    bool passed;
+    std::string detail;
+};
+
+// ---------------------------------------------------------------------------
+// Fixtures
+
+// Deterministic pseudo-random image, so every run filters the same pixels.
+static GrayscaleImage make_image(int width, int height, uint32_t seed) {
+    GrayscaleImage image(width, height);
+    uint32_t state = seed * 2654435761u + 1;
+    for (int i = 0; i < height; i++) {
+        uint8_t* row = image.row(i);
+        for (int j = 0; j < width; j++) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            row[j] = static_cast<uint8_t>(state >> 24);
+        }
+    }
+    return image;
+}
+
+// RGB image with a different pseudo-random plane per channel.
+static ColorImage make_color_image(int width, int height, uint32_t seed) {
+    std::vector<GrayscaleImage> planes;
+    for (int c = 0; c < 3; c++) {
+        planes.push_back(make_image(width, height, seed + c));
+    }
+    return ColorImage(std::move(planes));
+}
+
+static std::string make_message(size_t length) {
+    std::string message(length, ' ');
+    for (size_t i = 0; i < length; i++) {
+        message[i] = static_cast<char>('a' + i % 26);
+    }
+    return message;
+}
+
+static std::string temp_path(const std::string& name) {
+    const char* directory = std::getenv("TMPDIR");
+    return std::string(directory != nullptr ? directory : "/tmp") + "/clearvision_bench_" + name;
+}
+
+// Registers every operation over the requested image sizes and kernel sizes.
+static std::vector<Benchmark> make_benchmarks(const std::vector<int>& sizes, const std::vector<int>& kernels) {
+    std::vector<Benchmark> benchmarks;
+    for (size_t s = 0; s < sizes.size(); s++) {
+        int size = sizes[s];
+        double pixels = (double) size * size;
+        std::string suffix = "/" + std::to_string(size);
+
+        // 1. Filters. Each iteration filters a fresh copy of the input, since
+        //    repeated smoothing flattens the image and changes the Gaussian's cost.
+        for (size_t k = 0; k < kernels.size(); k++) {
+            int kernel = kernels[k];
+            std::string kernelSuffix = suffix + "/" + std::to_string(kernel);
+            benchmarks.push_back({ "BM_mean" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::apply_mean_filter(image, kernel);
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+            benchmarks.push_back({ "BM_gaussian" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::apply_gaussian_smoothing(image, kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0);
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+            benchmarks.push_back({ "BM_gaussian_reflect" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::apply_gaussian_smoothing(image, kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0,
+                                                     BORDER_REFLECT);
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+            benchmarks.push_back({ "BM_gaussian_pyramid" + kernelSuffix, [=](BenchState& state) {
+                ImagePyramid pyramid(make_image(size, size, 1));
+                while (state.keep_running()) {
+                    pyramid.gaussian(kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0, BORDER_ZERO, BLUR_AUTO);
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+            benchmarks.push_back({ "BM_gaussian_fixed" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                Filter::set_precision(PRECISION_FIXED_POINT);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::apply_gaussian_smoothing(image, kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0);
+                }
+                Filter::set_precision(PRECISION_EXACT);
+                state.set_bytes_per_iteration(pixels);
+            } });
+            benchmarks.push_back({ "BM_unsharp" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::apply_unsharp_mask(image, kernel, 1.5);
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+            benchmarks.push_back({ "BM_unsharp_fixed" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                Filter::set_precision(PRECISION_FIXED_POINT);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::apply_unsharp_mask(image, kernel, 1.5);
+                }
+                Filter::set_precision(PRECISION_EXACT);
+                state.set_bytes_per_iteration(pixels);
+            } });
+
+            // Re-filtering after a 16x16 edit, which only recomputes the tiles it reaches.
+            benchmarks.push_back({ "BM_incremental_gaussian" + kernelSuffix, [=](BenchState& state) {
+                IncrementalFilter filter(make_image(size, size, 1));
+                filter.gaussian(kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0);
+                filter.result();
+                ImageRect rect = { size / 2, size / 2, std::min(16, size / 2), std::min(16, size / 2) };
+                int value = 0;
+                while (state.keep_running()) {
+                    ImageView view = filter.edit(rect);
+                    view.row(0)[0] = static_cast<uint8_t>(value++);
+                    filter.result();
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+
+            // Repeating a cached filter: the cost of a memory-tier hit, hashing included.
+            benchmarks.push_back({ "BM_cached_gaussian" + kernelSuffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                ResultCache::set_enabled(true);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    ResultCache::apply_gaussian_smoothing(image, kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0);
+                }
+                ResultCache::clear();
+                ResultCache::set_enabled(false);
+                state.set_bytes_per_iteration(pixels);
+            } });
+
+            // RGB versions of the same filters, counted in bytes of all three channels.
+            benchmarks.push_back({ "BM_color_mean" + kernelSuffix, [=](BenchState& state) {
+                ColorImage input = make_color_image(size, size, 1);
+                while (state.keep_running()) {
+                    ColorImage image = input;
+                    Filter::apply_mean_filter(image, kernel);
+                }
+                state.set_bytes_per_iteration(3 * pixels);
+            } });
+            benchmarks.push_back({ "BM_color_gaussian" + kernelSuffix, [=](BenchState& state) {
+                ColorImage input = make_color_image(size, size, 1);
+                while (state.keep_running()) {
+                    ColorImage image = input;
+                    Filter::apply_gaussian_smoothing(image, kernel, kernel / 6.0 > 1.0 ? kernel / 6.0 : 1.0);
+                }
+                state.set_bytes_per_iteration(3 * pixels);
+            } });
+            benchmarks.push_back({ "BM_color_unsharp" + kernelSuffix, [=](BenchState& state) {
+                ColorImage input = make_color_image(size, size, 1);
+                while (state.keep_running()) {
+                    ColorImage image = input;
+                    Filter::apply_unsharp_mask(image, kernel, 1.5);
+                }
+                state.set_bytes_per_iteration(3 * pixels);
+            } });
+        }
+
+        // 2. Convolution with common kernels: integer separable, integer 2D and a
+        //    7x7 floating-point kernel with no structure.
+        std::vector<double> weights7x7(49);
+        for (size_t i = 0; i < weights7x7.size(); i++) {
+            weights7x7[i] = 1.0 / (i + 3.5);
+        }
+        const std::pair<std::string, ConvolutionKernel> convolutions[] = {
+            std::make_pair(std::string("sobel_x"), ConvolutionKernel::sobel_x()),
+            std::make_pair(std::string("laplacian"), ConvolutionKernel::laplacian()),
+            std::make_pair(std::string("custom7x7"), ConvolutionKernel(7, 7, weights7x7, 10.0)),
+        };
+        for (const std::pair<std::string, ConvolutionKernel>& convolution : convolutions) {
+            ConvolutionKernel kernel = convolution.second;
+            benchmarks.push_back({ "BM_convolve_" + convolution.first + suffix, [=](BenchState& state) {
+                GrayscaleImage input = make_image(size, size, 1);
+                while (state.keep_running()) {
+                    GrayscaleImage image = input;
+                    Filter::convolve(image, kernel, BORDER_REPLICATE);
+                }
+                state.set_bytes_per_iteration(pixels);
+            } });
+        }
+
+        // 3. Operators.
+        benchmarks.push_back({ "BM_add" + suffix, [=](BenchState& state) {
+            GrayscaleImage a = make_image(size, size, 1);
+            GrayscaleImage b = make_image(size, size, 2);
+            while (state.keep_running()) {
+                GrayscaleImage sum = a + b;
+            }
+            state.set_bytes_per_iteration(3 * pixels);
+        } });
+        benchmarks.push_back({ "BM_subtract" + suffix, [=](BenchState& state) {
+            GrayscaleImage a = make_image(size, size, 1);
+            GrayscaleImage b = make_image(size, size, 2);
+            while (state.keep_running()) {
+                GrayscaleImage difference = a - b;
+            }
+            state.set_bytes_per_iteration(3 * pixels);
+        } });
+        benchmarks.push_back({ "BM_equals" + suffix, [=](BenchState& state) {
+            // Equal images, so the comparison cannot stop early.
+            GrayscaleImage a = make_image(size, size, 1);
+            GrayscaleImage b = a;
+            bool equal = true;
+            while (state.keep_running()) {
+                equal = equal && a == b;
+            }
+            if (!equal) {
+                throw std::logic_error("BM_equals: copies compared unequal");
+            }
+            state.set_bytes_per_iteration(2 * pixels);
+        } });
+        benchmarks.push_back({ "BM_compare_identical" + suffix, [=](BenchState& state) {
+            GrayscaleImage a = make_image(size, size, 1);
+            GrayscaleImage b = a;
+            while (state.keep_running()) {
+                ImageCompare::compare(a, b);
+            }
+            state.set_bytes_per_iteration(2 * pixels);
+        } });
+        benchmarks.push_back({ "BM_compare_different" + suffix, [=](BenchState& state) {
+            // Every row differs, so every pixel takes the full statistics path.
+            GrayscaleImage a = make_image(size, size, 1);
+            GrayscaleImage b = make_image(size, size, 2);
+            while (state.keep_running()) {
+                ImageCompare::compare(a, b);
+            }
+            state.set_bytes_per_iteration(2 * pixels);
+        } });
+
+        // 4. SecretImage.
+        benchmarks.push_back({ "BM_secret_split" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = make_image(size, size, 1);
+            while (state.keep_running()) {
+                SecretImage secret(image);
+            }
+            state.set_bytes_per_iteration(2 * pixels);
+        } });
+        benchmarks.push_back({ "BM_secret_reconstruct" + suffix, [=](BenchState& state) {
+            SecretImage secret(make_image(size, size, 1));
+            while (state.keep_running()) {
+                GrayscaleImage image = secret.reconstruct();
+            }
+            state.set_bytes_per_iteration(2 * pixels);
+        } });
+        const char* formatNames[2] = { "text", "binary" };
+        for (int f = 0; f < 2; f++) {
+            SecretImage::FileFormat format = f == 0 ? SecretImage::TEXT : SecretImage::BINARY;
+            std::string path = temp_path(std::string(formatNames[f]) + suffix.substr(1) + ".dat");
+            benchmarks.push_back({ std::string("BM_secret_save_") + formatNames[f] + suffix, [=](BenchState& state) {
+                SecretImage secret(make_image(size, size, 1));
+                while (state.keep_running()) {
+                    secret.save_to_file(path, format);
+                }
+                state.set_bytes_per_iteration(pixels);
+                std::remove(path.c_str());
+            } });
+            benchmarks.push_back({ std::string("BM_secret_load_") + formatNames[f] + suffix, [=](BenchState& state) {
+                SecretImage(make_image(size, size, 1)).save_to_file(path, format);
+                while (state.keep_running()) {
+                    SecretImage secret = SecretImage::load_from_file(path);
+                }
+                state.set_bytes_per_iteration(pixels);
+                std::remove(path.c_str());
+            } });
+        }
+
+        // 5. Crypto, with a message that fills the image.
+        std::string message = make_message((size_t) size * size / 7);
+        benchmarks.push_back({ "BM_crypto_embed" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = make_image(size, size, 1);
+            while (state.keep_running()) {
+                BitBuffer bits = Crypto::encrypt_message_bits(message);
+                SecretImage secret = Crypto::embed_LSB_bits(image, bits);
+            }
+            state.set_bytes_per_iteration(pixels);
+        } });
+        benchmarks.push_back({ "BM_crypto_extract" + suffix, [=](BenchState& state) {
+            GrayscaleImage image = make_image(size, size, 1);
+            SecretImage secret = Crypto::embed_LSB_bits(image, Crypto::encrypt_message_bits(message));
+            while (state.keep_running()) {
+                BitBuffer bits = Crypto::extract_LSB_bits(secret, (int) message.size());
+                std::string revealed = Crypto::decrypt_message_bits(bits);
+            }
+            state.set_bytes_per_iteration(pixels);
+        } });
+    }
+    return benchmarks;
+}
+
+// ---------------------------------------------------------------------------
+// Goldens
+
+// Describes how two images differ by more than tolerance gray levels, or returns
+// an empty string if no pixel does.
+static std::string describe_difference(const GrayscaleImage& actual, const GrayscaleImage& expected,
+                                       int tolerance = 0) {
+    if (actual.get_width() != expected.get_width() || actual.get_height() != expected.get_height()) {
+        std::ostringstream out;
+        out << "size " << actual.get_width() << "x" << actual.get_height() << ", expected "
+            << expected.get_width() << "x" << expected.get_height();
+        return out.str();
+    }
+    CompareOptions options;
+    options.tolerance = tolerance;
+    ImageComparison comparison = ImageCompare::compare(actual, expected, options);
+    if (comparison.equal) {
+        return "";
+    }
+    const ImageRect& box = comparison.differenceBox;
+    std::ostringstream out;
+    out << comparison.differingPixels << " pixels differ, max difference " << comparison.maxDifference
+        << ", first at (" << comparison.firstRow << ", " << comparison.firstColumn << "), within rows "
+        << box.top << "-" << box.top + box.height - 1 << " and columns " << box.left << "-"
+        << box.left + box.width - 1 << ", PSNR " << comparison.psnr << " dB, SSIM " << comparison.ssim;
+    return out.str();
+}
+
+// Copy of image grown by radius pixels on every side, filled in by the border rule,
+// so zero-border filtering of it reads exactly what filtering image with border reads.
+static GrayscaleImage pad_image(const GrayscaleImage& image, int radius, BorderMode border) {
+    GrayscaleImage padded(image.get_width() + 2 * radius, image.get_height() + 2 * radius);
+    for (int i = 0; i < padded.get_height(); i++) {
+        int r = border_index(i - radius, image.get_height(), border);
+        for (int j = 0; j < padded.get_width(); j++) {
+            int c = border_index(j - radius, image.get_width(), border);
+            padded.set_pixel(i, j, r < 0 || c < 0 ? 0 : image.get_pixel(r, c));
+        }
+    }
+    return padded;
+}
+
+static GrayscaleImage crop_image(const GrayscaleImage& image, int top, int left, int width, int height) {
+    GrayscaleImage cropped(width, height);
+    for (int i = 0; i < height; i++) {
+        for (int j = 0; j < width; j++) {
+            cropped.set_pixel(i, j, image.get_pixel(top + i, left + j));
+        }
+    }
+    return cropped;
+}
+
+// Filter::convolve spelled out: every tap summed directly in integers for integral
+// kernels (then divided) and in doubles otherwise, truncated and clamped.
+static GrayscaleImage reference_convolve(const GrayscaleImage& image, const ConvolutionKernel& kernel,
+                                         BorderMode border) {
+    GrayscaleImage result(image.get_width(), image.get_height());
+    int kernelWidth = kernel.get_width();
+    int kernelHeight = kernel.get_height();
+    for (int i = 0; i < image.get_height(); i++) {
+        for (int j = 0; j < image.get_width(); j++) {
+            int integerSum = 0;
+            double realSum = 0;
+            for (int a = 0; a < kernelHeight; a++) {
+                int r = border_index(i + a - kernelHeight / 2, image.get_height(), border);
+                for (int b = 0; b < kernelWidth; b++) {
+                    int c = border_index(j + b - kernelWidth / 2, image.get_width(), border);
+                    int pixel = r < 0 || c < 0 ? 0 : image.get_pixel(r, c);
+                    if (kernel.is_integral()) {
+                        integerSum += kernel.get_integer_weights()[a * kernelWidth + b] * pixel;
+                    } else {
+                        realSum += kernel.get_weights()[a * kernelWidth + b] * pixel;
+                    }
+                }
+            }
+            int value = kernel.is_integral() ? integerSum / kernel.get_integer_divisor() : (int) realSum;
+            result.set_pixel(i, j, value < 0 ? 0 : (value > 255 ? 255 : value));
+        }
+    }
+    return result;
+}
+
+static void check_golden(std::vector<GoldenResult>& results, const std::string& name,
+                         const std::function<std::string()> check) {
+    GoldenResult result;
+    result.name = name;
+    try {
+        result.detail = check();
+    } catch (const std::exception& e) {
+        result.detail = e.what();
+    }
+    result.passed = result.detail.empty();
+    results.push_back(result);
+}
+
+static std::vector<GoldenResult> run_goldens(const std::string& directory) {
+    std::vector<GoldenResult> results;
+    auto load = [&](const std::string& path) { return GrayscaleImage::load((directory + "/" + path).c_str()); };
+
+    // 1. Filters, with the kernel size and parameter taken from the golden's name.
+    const int meanKernels[] = { 3, 11, 19 };
+    for (int kernel : meanKernels) {
+        std::string size = std::to_string(kernel) + "x" + std::to_string(kernel);
+        check_golden(results, "mean_" + size, [=]() {
+            GrayscaleImage image = load("mean/creep.jpg");
+            Filter::apply_mean_filter(image, kernel);
+            return describe_difference(image, load("mean/mean_filtered_creep_" + size + ".png"));
+        });
+    }
+    const int gaussKernels[] = { 21, 41 };
+    const int sigmas[] = { 2, 4 };
+    for (int kernel : gaussKernels) {
+        for (int sigma : sigmas) {
+            std::string name = std::to_string(kernel) + "x" + std::to_string(kernel) + "_" + std::to_string(sigma);
+            check_golden(results, "gaussian_" + name, [=]() {
+                GrayscaleImage image = load("gauss/puppy.png");
+                Filter::apply_gaussian_smoothing(image, kernel, sigma);
+                return describe_difference(image, load("gauss/gaussian_filtered_puppy_" + name + ".png"));
+            });
+        }
+    }
+    const int amounts[] = { 1, 5, 10 };
+    for (int amount : amounts) {
+        std::string name = "9x9_" + std::to_string(amount);
+        check_golden(results, "unsharp_" + name, [=]() {
+            GrayscaleImage image = load("unsharp/flowers.png");
+            Filter::apply_unsharp_mask(image, 9, amount);
+            return describe_difference(image, load("unsharp/unsharp_filtered_flowers_" + name + ".png"));
+        });
+    }
+
+    // Convolution must match the direct tap sum on every path: integer separable
+    // (Sobel, box), integer 2D (Laplacian), double separable and double 2D (7x5).
+    check_golden(results, "convolve_reference", [=]() {
+        std::vector<double> column = { 0.31, 0.77, 1.13, 0.77, 0.31 };
+        std::vector<double> row = { 0.05, 0.17, 0.29, 0.41, 0.29, 0.17, 0.05 };
+        std::vector<double> separable, mixed;
+        for (int a = 0; a < 5; a++) {
+            for (int b = 0; b < 7; b++) {
+                separable.push_back(column[a] * row[b]);
+                mixed.push_back(((a * 7 + b) * 37 % 11 - 4) * 0.0731);
+            }
+        }
+        std::vector<ConvolutionKernel> kernels;
+        kernels.push_back(ConvolutionKernel::sobel_x());
+        kernels.push_back(ConvolutionKernel::box(5));
+        kernels.push_back(ConvolutionKernel::laplacian());
+        kernels.push_back(ConvolutionKernel(7, 5, separable, 1.3));
+        kernels.push_back(ConvolutionKernel(7, 5, mixed, 0.9));
+        const char* names[] = { "sobel_x", "box_5", "laplacian", "separable_7x5", "2d_7x5" };
+        if (kernels[3].is_integral() || !kernels[3].is_separable() || kernels[4].is_integral()
+            || kernels[4].is_separable()) {
+            return std::string("the 7x5 kernels do not take the double paths");
+        }
+        GrayscaleImage source = make_image(150, 41, 13);
+        for (size_t k = 0; k < kernels.size(); k++) {
+            for (int border = BORDER_ZERO; border <= BORDER_WRAP; border++) {
+                GrayscaleImage image = source;
+                Filter::convolve(image, kernels[k], (BorderMode) border);
+                std::string difference = describe_difference(image, reference_convolve(source, kernels[k],
+                                                                                       (BorderMode) border));
+                if (!difference.empty()) {
+                    return std::string(names[k]) + " with border " + std::to_string(border) + ": " + difference;
+                }
+            }
+        }
+        return std::string();
+    });
+
+    // Every filter with a border mode must give what the zero-border filter gives
+    // on a copy padded by that mode, cropped back; incremental filtering too, after
+    // edits at the corners whose halos wrap or reflect across the image.
+    const BorderMode borders[] = { BORDER_REPLICATE, BORDER_REFLECT, BORDER_WRAP };
+    const char* borderNames[] = { "replicate", "reflect", "wrap" };
+    for (int m = 0; m < 3; m++) {
+        BorderMode border = borders[m];
+        check_golden(results, std::string("border_") + borderNames[m], [=]() {
+            GrayscaleImage source = make_image(83, 57, 11);
+            std::vector<std::function<void(GrayscaleImage&, BorderMode)> > filters;
+            filters.push_back([](GrayscaleImage& image, BorderMode mode) { Filter::apply_mean_filter(image, 5, mode); });
+            filters.push_back([](GrayscaleImage& image, BorderMode mode) { Filter::apply_gaussian_smoothing(image, 7, 2, mode); });
+            filters.push_back([](GrayscaleImage& image, BorderMode mode) { Filter::apply_unsharp_mask(image, 5, 3, mode); });
+            filters.push_back([](GrayscaleImage& image, BorderMode mode) {
+                Filter::convolve(image, ConvolutionKernel::sobel_x(), mode);
+            });
+            const char* filterNames[] = { "mean", "gaussian", "unsharp", "sobel_x" };
+            auto expected_for = [&](const GrayscaleImage& image, int f) {
+                GrayscaleImage padded = pad_image(image, 3, border);
+                filters[f](padded, BORDER_ZERO);
+                return crop_image(padded, 3, 3, image.get_width(), image.get_height());
+            };
+            for (size_t f = 0; f < filters.size(); f++) {
+                GrayscaleImage image = source;
+                filters[f](image, border);
+                std::string difference = describe_difference(image, expected_for(source, (int) f));
+                if (!difference.empty()) {
+                    return std::string(filterNames[f]) + ": " + difference;
+                }
+            }
+
+            IncrementalFilter incremental(source, 16);
+            incremental.gaussian(7, 2, border);
+            incremental.result();
+            ImageRect corners[] = { { 0, 0, 4, 5 }, { 53, 78, 4, 5 } };
+            for (const ImageRect& rect : corners) {
+                ImageView view = incremental.edit(rect);
+                for (int i = 0; i < view.height; i++) {
+                    for (int j = 0; j < view.width; j++) {
+                        view.row(i)[j] = static_cast<uint8_t>(255 - view.row(i)[j]);
+                    }
+                }
+            }
+            if (incremental.get_stale_tile_count() >= incremental.get_tile_count()) {
+                return std::string("corner edits marked every tile stale");
+            }
+            std::string difference = describe_difference(incremental.result(), expected_for(incremental.get_source(), 1));
+            return difference.empty() ? difference : "incremental gaussian: " + difference;
+        });
+    }
+
+    // 2. The fixed-point filters must stay within their documented distance of the
+    //    same goldens: one gray level for the Gaussian, ceil(amount) + 1 for unsharp.
+    struct FixedPointScope {
+        FixedPointScope() { Filter::set_precision(PRECISION_FIXED_POINT); }
+        ~FixedPointScope() { Filter::set_precision(PRECISION_EXACT); }
+    };
+    for (int kernel : gaussKernels) {
+        for (int sigma : sigmas) {
+            std::string name = std::to_string(kernel) + "x" + std::to_string(kernel) + "_" + std::to_string(sigma);
+            check_golden(results, "gaussian_fixed_" + name, [=]() {
+                GrayscaleImage image = load("gauss/puppy.png");
+                {
+                    FixedPointScope fixedPoint;
+                    Filter::apply_gaussian_smoothing(image, kernel, sigma);
+                }
+                return describe_difference(image, load("gauss/gaussian_filtered_puppy_" + name + ".png"), 1);
+            });
+        }
+    }
+    for (int amount : amounts) {
+        std::string name = "9x9_" + std::to_string(amount);
+        check_golden(results, "unsharp_fixed_" + name, [=]() {
+            GrayscaleImage image = load("unsharp/flowers.png");
+            {
+                FixedPointScope fixedPoint;
+                Filter::apply_unsharp_mask(image, 9, amount);
+            }
+            return describe_difference(image, load("unsharp/unsharp_filtered_flowers_" + name + ".png"), amount + 1);
+        });
+    }
+
+    // 3. The pyramid blur is approximate: BLUR_AUTO must pick it for the large
+    //    kernel, and its mean error against the golden must stay small.
+    check_golden(results, "gaussian_pyramid_41x41_4", [=]() {
+        ImagePyramid pyramid(load("gauss/puppy.png"));
+        BlurReport report;
+        GrayscaleImage image = pyramid.gaussian(41, 4, BORDER_ZERO, BLUR_AUTO, &report);
+        GrayscaleImage expected = load("gauss/gaussian_filtered_puppy_41x41_4.png");
+        if (report.plan.path != BLUR_PYRAMID) {
+            return std::string("automatic selection took the direct path");
+        }
+        double totalError = 0;
+        for (int i = 0; i < image.get_height(); i++) {
+            for (int j = 0; j < image.get_width(); j++) {
+                totalError += std::abs(image.get_pixel(i, j) - expected.get_pixel(i, j));
+            }
+        }
+        double meanError = totalError / ((double) image.get_width() * image.get_height());
+        if (meanError > 1.5) {
+            return "mean error " + std::to_string(meanError);
+        }
+        return std::string();
+    });
+
+    // 4. The color filters must give every channel what the grayscale filter gives
+    //    that plane alone; the blank middle channel catches channels mixing.
+    auto check_planes = [](const ColorImage& image, const GrayscaleImage& expected) {
+        GrayscaleImage blank(expected.get_width(), expected.get_height());
+        for (int c = 0; c < image.get_channels(); c++) {
+            std::string difference = describe_difference(image.plane(c), c == 1 ? blank : expected);
+            if (!difference.empty()) {
+                return "channel " + std::to_string(c) + ": " + difference;
+            }
+        }
+        return std::string();
+    };
+    check_golden(results, "color_gaussian_21x21_2", [=]() {
+        GrayscaleImage plane = load("gauss/puppy.png");
+        std::vector<GrayscaleImage> planes;
+        planes.push_back(plane);
+        planes.push_back(GrayscaleImage(plane.get_width(), plane.get_height()));
+        planes.push_back(plane);
+        ColorImage image(std::move(planes));
+        Filter::apply_gaussian_smoothing(image, 21, 2);
+        return check_planes(image, load("gauss/gaussian_filtered_puppy_21x21_2.png"));
+    });
+    check_golden(results, "color_unsharp_9x9_5", [=]() {
+        GrayscaleImage plane = load("unsharp/flowers.png");
+        std::vector<GrayscaleImage> planes;
+        planes.push_back(plane);
+        planes.push_back(GrayscaleImage(plane.get_width(), plane.get_height()));
+        planes.push_back(plane);
+        ColorImage image(std::move(planes));
+        Filter::apply_unsharp_mask(image, 9, 5);
+        return check_planes(image, load("unsharp/unsharp_filtered_flowers_9x9_5.png"));
+    });
+
+    // 5. Incremental filtering must match the golden, and after an edit the full
+    //    filter of the edited image, while recomputing only part of the tiles.
+    check_golden(results, "incremental_gaussian_21x21_2", [=]() {
+        IncrementalFilter filter(load("gauss/puppy.png"));
+        filter.gaussian(21, 2);
+        std::string difference = describe_difference(filter.result(), load("gauss/gaussian_filtered_puppy_21x21_2.png"));
+        if (!difference.empty()) {
+            return difference;
+        }
+        ImageRect rect = { filter.get_source().get_height() / 3, filter.get_source().get_width() / 3, 20, 30 };
+        ImageView view = filter.edit(rect);
+        for (int i = 0; i < view.height; i++) {
+            for (int j = 0; j < view.width; j++) {
+                view.row(i)[j] = static_cast<uint8_t>(255 - view.row(i)[j]);
+            }
+        }
+        if (filter.get_stale_tile_count() >= filter.get_tile_count()) {
+            return std::string("a small edit marked every tile stale");
+        }
+        GrayscaleImage expected = filter.get_source();
+        Filter::apply_gaussian_smoothing(expected, 21, 2);
+        return describe_difference(filter.result(), expected);
+    });
+
+    // 6. A cached filter must give the golden both when it computes the result and
+    //    when it finds it in the cache.
+    check_golden(results, "cached_gaussian_21x21_2", [=]() {
+        ResultCache::set_enabled(true);
+        ResultCache::reset_stats();
+        GrayscaleImage first = load("gauss/puppy.png");
+        GrayscaleImage second = first;
+        ResultCache::apply_gaussian_smoothing(first, 21, 2);
+        ResultCache::apply_gaussian_smoothing(second, 21, 2);
+        ResultCacheStats stats = ResultCache::stats();
+        ResultCache::clear();
+        ResultCache::set_enabled(false);
+        GrayscaleImage expected = load("gauss/gaussian_filtered_puppy_21x21_2.png");
+        std::string difference = describe_difference(first, expected);
+        if (difference.empty()) {
+            difference = describe_difference(second, expected);
+        }
+        if (difference.empty() && (stats.misses != 1 || stats.memoryHits != 1)) {
+            difference = "expected one miss and one hit";
+        }
+        return difference;
+    });
+
+    // Flipping the top bit of two bytes 8 apart, which a multiply-only word hash
+    // cancels out, must change the key, and the cache must not hand the first
+    // image's result out for the second.
+    check_golden(results, "cache_key_high_bits", [=]() {
+        uint8_t bytes[64] = { 0 };
+        uint64_t base = ResultCache::hash_bytes(bytes, sizeof(bytes));
+        for (int i = 0; i + 8 < 64; i++) {
+            bytes[i] ^= 0x80;
+            bytes[i + 8] ^= 0x80;
+            uint64_t flipped = ResultCache::hash_bytes(bytes, sizeof(bytes));
+            bytes[i] ^= 0x80;
+            bytes[i + 8] ^= 0x80;
+            if (flipped == base) {
+                return "bytes " + std::to_string(i) + " and " + std::to_string(i + 8) + " cancel out";
+            }
+        }
+
+        GrayscaleImage first = make_image(64, 64, 5);
+        GrayscaleImage second = first;
+        second.set_pixel(8, 7, second.get_pixel(8, 7) ^ 0x80);
+        second.set_pixel(8, 15, second.get_pixel(8, 15) ^ 0x80);
+        if (ResultCache::hash_image(first) == ResultCache::hash_image(second)) {
+            return std::string("images differing in two pixels share a key");
+        }
+        GrayscaleImage expected = second;
+        Filter::apply_mean_filter(expected, 3);
+        ResultCache::set_enabled(true);
+        ResultCache::apply_mean_filter(first, 3);
+        ResultCache::apply_mean_filter(second, 3);
+        ResultCache::clear();
+        ResultCache::set_enabled(false);
+        return describe_difference(second, expected);
+    });
+
+    // 7. Operators.
+    check_golden(results, "add", [=]() {
+        GrayscaleImage sum = load("addition/image1.png") + load("addition/image2.png");
+        return describe_difference(sum, load("addition/added_image1_image2.png"));
+    });
+    check_golden(results, "subtract", [=]() {
+        GrayscaleImage difference = load("subtraction/image1.png") - load("subtraction/image2.png");
+        return describe_difference(difference, load("subtraction/subtracted_image1_image2.png"));
+    });
+
+    // A streamed chain must give what the Filter functions and operators give one
+    // after another, in both precisions.
+    check_golden(results, "pipeline_chain", [=]() {
+        GrayscaleImage source = make_image(97, 211, 17);
+        GrayscaleImage addend = make_image(97, 211, 18);
+        GrayscaleImage subtrahend = make_image(97, 211, 19);
+        FilterPipeline pipeline;
+        pipeline.gaussian(9, 2).unsharp(5, 2.5).mean(3).add(addend).subtract(subtrahend);
+        auto compare = [&]() {
+            GrayscaleImage expected = source;
+            Filter::apply_gaussian_smoothing(expected, 9, 2);
+            Filter::apply_unsharp_mask(expected, 5, 2.5);
+            Filter::apply_mean_filter(expected, 3);
+            expected = expected + addend - subtrahend;
+            GrayscaleImage image = source;
+            pipeline.run(image);
+            return describe_difference(image, expected);
+        };
+        std::string difference = compare();
+        if (!difference.empty()) {
+            return "exact: " + difference;
+        }
+        FixedPointScope fixedPoint;
+        difference = compare();
+        return difference.empty() ? difference : "fixed point: " + difference;
+    });
+
+    // 8. The secret image file must hold the same arrays as splitting the image.
+    check_golden(results, "secret_split_load", [=]() {
+        GrayscaleImage image = load("disguise-reveal/flowers.png");
+        SecretImage split(image);
+        SecretImage loaded = SecretImage::load_from_file(directory + "/disguise-reveal/secret_image_flowers.dat");
+        std::string difference = describe_difference(loaded.reconstruct(), image);
+        if (difference.empty() && !(split.reconstruct() == image)) {
+            difference = "split and reconstruct does not round-trip";
+        }
+        return difference;
+    });
+
+    // The golden secret image, loaded through a mapping, embedded into and saved back
+    // to the file it came from in each format, must read back as saved.
+    check_golden(results, "secret_save_in_place", [=]() {
+        std::string path = temp_path("in_place.dat");
+        SecretImage(load("disguise-reveal/flowers.png")).save_to_file(path, SecretImage::BINARY);
+        std::string difference;
+        SecretImage::FileFormat formats[2] = { SecretImage::BINARY, SecretImage::TEXT };
+        for (int f = 0; f < 2 && difference.empty(); f++) {
+            SecretImage secret = SecretImage::load_from_file(path);
+            Crypto::embed_LSB_bits(secret, Crypto::encrypt_message_bits(f == 0 ? "binary" : "text"));
+            GrayscaleImage expected = secret.reconstruct();
+            secret.save_to_file(path, formats[f]);
+            difference = describe_difference(SecretImage::load_from_file(path).reconstruct(), expected);
+        }
+        std::remove(path.c_str());
+        return difference;
+    });
+
+    // 9. Embedding the message must give the golden image, and extracting must give the message back.
+    check_golden(results, "crypto_embed_extract", [=]() {
+        std::ifstream messageFile(directory + "/secret message encrpytion/secret_message.txt");
+        std::string message;
+        std::getline(messageFile, message);
+        if (!message.empty() && message[message.size() - 1] == '\r') {
+            message.erase(message.size() - 1);
+        }
+        GrayscaleImage image = load("secret message encrpytion/puppy.png");
+        SecretImage secret = Crypto::embed_LSB_bits(image, Crypto::encrypt_message_bits(message));
+        std::string difference = describe_difference(secret.reconstruct(),
+                                                     load("secret message encrpytion/puppy_with_secret_message_embedded.png"));
+        if (difference.empty()) {
+            std::string revealed = Crypto::decrypt_message_bits(Crypto::extract_LSB_bits(secret, (int) message.size()));
+            if (revealed != message) {
+                difference = "extracted '" + revealed + "'";
+            }
+        }
+        return difference;
+    });
+    return results;
+}
+
+// ---------------------------------------------------------------------------
+// Reporting
+
+static std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// Same layout as Google Benchmark's --benchmark_format=json, plus the goldens.
+static void write_json(const std::string& filename, const std::vector<BenchRun>& runs,
+                       const std::vector<GoldenResult>& goldens) {
+    std::ofstream out(filename);
+    std::time_t now = std::time(nullptr);
+    char date[64];
+    std::strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+    BufferPoolStats pool = BufferPool::stats();
+
+    out << "{\n  \"context\": {\n"
+        << "    \"date\": " << json_string(date) << ",\n"
+        << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n"
+        << "    \"threads\": " << Filter::get_thread_count() << ",\n"
+        << "    \"instruction_set\": " << json_string(PixelOps::instruction_set()) << ",\n"
+        << "    \"buffer_pool_peak_bytes\": " << pool.peakBytes << ",\n"
+        << "    \"buffer_pool_hit_rate\": " << pool.hit_rate() << "\n"
+        << "  },\n  \"benchmarks\": [";
+    for (size_t i = 0; i < runs.size(); i++) {
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"name\": " << json_string(runs[i].name)
+            << ", \"iterations\": " << runs[i].iterations
+            << ", \"real_time\": " << runs[i].realNanoseconds
+            << ", \"cpu_time\": " << runs[i].cpuNanoseconds
+            << ", \"time_unit\": \"ns\""
+            << ", \"bytes_per_second\": " << runs[i].bytesPerSecond << "}";
+    }
+    out << "\n  ],\n  \"goldens\": [";
+    for (size_t i = 0; i < goldens.size(); i++) {
+        out << (i == 0 ? "\n" : ",\n")
+            << "    {\"name\": " << json_string(goldens[i].name)
+            << ", \"passed\": " << (goldens[i].passed ? "true" : "false")
+            << ", \"detail\": " << json_string(goldens[i].detail) << "}";
+    }
+    out << "\n  ]\n}\n";
+    if (!out) {
+        throw std::runtime_error("Could not write " + filename);
+    }
+}
+
+static std::vector<int> parse_list(const std::string& text) {
+    std::vector<int> values;
+    std::istringstream in(text);
+    std::string item;
+    while (std::getline(in, item, ',')) {
+        values.push_back(std::stoi(item));
+    }
+    return values;
+}
+
+int main(int argc, char** argv) {
+    std::vector<int> sizes = { 256, 512, 1024, 2048, 4096, 8192 };
+    std::vector<int> kernels = { 3, 5, 9, 21, 41 };
+    std::string filter, jsonFile;
+    std::string goldenDirectory = "sample_io";
+    double minTime = 0.5;
+    bool runBenchmarks = true, runGoldenChecks = true;
+
+    // 1. Parse the options.
+    for (int i = 1; i < argc; i++) {
+        std::string option = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (option == "--filter" && hasValue) {
+            filter = argv[++i];
+        } else if (option == "--sizes" && hasValue) {
+            sizes = parse_list(argv[++i]);
+        } else if (option == "--kernels" && hasValue) {
+            kernels = parse_list(argv[++i]);
+        } else if (option == "--min-time" && hasValue) {
+            minTime = std::atof(argv[++i]);
+        } else if (option == "--json" && hasValue) {
+            jsonFile = argv[++i];
+        } else if (option == "--golden-dir" && hasValue) {
+            goldenDirectory = argv[++i];
+        } else if (option == "--goldens-only") {
+            runBenchmarks = false;
+        } else if (option == "--no-goldens") {
+            runGoldenChecks = false;
+        } else {
+            std::cerr << "Unknown option " << option << std::endl;
+            return 2;
+        }
+    }
+
+    // 2. Golden checks.
+    std::vector<GoldenResult> goldens;
+    bool goldensPassed = true;
+    if (runGoldenChecks) {
+        goldens = run_goldens(goldenDirectory);
+        for (const GoldenResult& golden : goldens) {
+            std::printf("%-28s %s %s\n", golden.name.c_str(), golden.passed ? "PASS" : "FAIL", golden.detail.c_str());
+            goldensPassed = goldensPassed && golden.passed;
+        }
+    }
+
+    // 3. Benchmarks whose name contains the filter.
+    std::vector<BenchRun> runs;
+    if (runBenchmarks) {
+        std::printf("%-36s %14s %14s %12s %10s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations", "MB/s");
+        for (const Benchmark& benchmark : make_benchmarks(sizes, kernels)) {
+            if (benchmark.name.find(filter) == std::string::npos) {
+                continue;
+            }
+            BenchRun run = run_benchmark(benchmark, minTime);
+            std::printf("%-36s %14.0f %14.0f %12ld %10.1f\n", run.name.c_str(), run.realNanoseconds,
+                        run.cpuNanoseconds, run.iterations, run.bytesPerSecond / 1e6);
+            std::fflush(stdout);
+            runs.push_back(run);
+        }
+    }
+
+    if (!jsonFile.empty()) {
+        write_json(jsonFile, runs, goldens);
+    }
+    return goldensPassed ? 0 : 1;
+}
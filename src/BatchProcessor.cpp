@@ -0,0 +1,335 @@
+#include "BatchProcessor.h"
+#include "BoundedQueue.h"
+#include "Crypto.h"
+#include "GrayscaleImage.h"
+#include "ResultCache.h"
+#include "SecretImage.h"
+#include "Trace.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <thread>
+#include <utility>
+
+// Shape of each manifest operation: its input files, whether it writes an
+// output file, its numeric parameters and whether the rest of the line is text.
+struct OperationSpec {
+    const char* name;
+    int inputs;
+    bool hasOutput;
+    int params;
+    bool hasMessage;
+};
+
+static const OperationSpec OPERATIONS[] = {
+    { "mean",     1, true,  1, false },
+    { "gaussian", 1, true,  2, false },
+    { "unsharp",  1, true,  2, false },
+    { "add",      2, true,  0, false },
+    { "subtract", 2, true,  0, false },
+    { "equals",   2, false, 0, false },
+    { "disguise", 1, true,  0, true  },
+    { "reveal",   1, true,  1, false },
+};
+
+static const OperationSpec* find_operation(const std::string& name) {
+    for (size_t i = 0; i < sizeof(OPERATIONS) / sizeof(OPERATIONS[0]); i++) {
+        if (name == OPERATIONS[i].name) {
+            return &OPERATIONS[i];
+        }
+    }
+    return nullptr;
+}
+
+// A job on its way through the stages: the decoded inputs, then the results.
+struct BatchItem {
+    size_t index;
+    std::vector<GrayscaleImage> images;
+    std::unique_ptr<SecretImage> secret;
+    std::string text;
+
+    BatchItem() : index(0) {}
+};
+
+// Stage 1: load every input of the job.
+static void decode_job(const BatchJob& job, BatchItem& item) {
+    ScopedTimer timer("batch.decode");
+    if (job.operation == "reveal") {
+        item.secret.reset(new SecretImage(SecretImage::load_from_file(job.inputs[0])));
+        return;
+    }
+    for (size_t i = 0; i < job.inputs.size(); i++) {
+        item.images.push_back(GrayscaleImage::load(job.inputs[i].c_str()));
+    }
+}
+
+// Stage 2: run the operation, leaving the result in images[0], secret or text.
+// Operations go through the ResultCache, which calls straight through while off.
+static void compute_job(const BatchJob& job, BatchItem& item) {
+    ScopedTimer timer("batch.compute");
+    const std::string& operation = job.operation;
+    if (operation == "mean") {
+        ResultCache::apply_mean_filter(item.images[0], (int) job.params[0]);
+    } else if (operation == "gaussian") {
+        ResultCache::apply_gaussian_smoothing(item.images[0], (int) job.params[0], job.params[1]);
+    } else if (operation == "unsharp") {
+        ResultCache::apply_unsharp_mask(item.images[0], (int) job.params[0], job.params[1]);
+    } else if (operation == "add") {
+        item.images[0] = ResultCache::add(item.images[0], item.images[1]);
+    } else if (operation == "subtract") {
+        item.images[0] = ResultCache::subtract(item.images[0], item.images[1]);
+    } else if (operation == "equals") {
+        item.text = item.images[0] == item.images[1] ? "equal" : "different";
+    } else if (operation == "disguise") {
+        BitBuffer bits = Crypto::encrypt_message_bits(job.message);
+        item.secret.reset(new SecretImage(ResultCache::embed_LSB_bits(item.images[0], bits)));
+    } else if (operation == "reveal") {
+        BitBuffer bits = Crypto::extract_LSB_bits(*item.secret, (int) job.params[0]);
+        item.text = Crypto::decrypt_message_bits(bits);
+    }
+    // Release the inputs the encoder does not need.
+    size_t keep = (operation == "equals" || operation == "reveal") ? 0 : 1;
+    if (item.images.size() > keep) {
+        item.images.erase(item.images.begin() + keep, item.images.end());
+    }
+}
+
+// Stage 3: write the result and fill in the job's report.
+static void encode_job(const BatchJob& job, BatchItem& item, BatchResult& result) {
+    ScopedTimer timer("batch.encode");
+    if (job.operation == "equals") {
+        result.message = item.text;
+    } else if (job.operation == "disguise") {
+        item.secret->save_to_file(job.output);
+    } else if (job.operation == "reveal") {
+        std::ofstream outFile(job.output);
+        outFile << item.text << std::endl;
+        if (!outFile) {
+            throw std::runtime_error("Could not write " + job.output);
+        }
+        result.message = item.text;
+    } else if (!item.images[0].save_to_file(job.output.c_str())) {
+        throw std::runtime_error("Could not save image to file " + job.output);
+    }
+}
+
+// Runs fn for one job, turning an exception into a failed result.
+template <typename Fn>
+static bool run_guarded(BatchResult& result, Fn fn) {
+    try {
+        fn();
+        return true;
+    } catch (const std::exception& e) {
+        result.message = e.what();
+    } catch (...) {
+        result.message = "Unknown error";
+    }
+    result.succeeded = false;
+    return false;
+}
+
+std::vector<BatchJob> BatchProcessor::parse_manifest(const std::string& filename) {
+    std::ifstream inFile(filename);
+    if (!inFile) {
+        throw std::runtime_error("Could not open manifest " + filename);
+    }
+
+    std::vector<BatchJob> jobs;
+    std::string text;
+    for (int line = 1; std::getline(inFile, text); line++) {
+        if (!text.empty() && text[text.size() - 1] == '\r') {
+            text.erase(text.size() - 1);
+        }
+        std::istringstream tokens(text);
+        BatchJob job;
+        job.line = line;
+        if (!(tokens >> job.operation) || job.operation[0] == '#') {
+            continue;
+        }
+
+        // 1. Look the operation up and read its files and parameters in order.
+        std::string where = filename + ":" + std::to_string(line) + ": ";
+        const OperationSpec* spec = find_operation(job.operation);
+        if (spec == nullptr) {
+            throw std::runtime_error(where + "unknown operation '" + job.operation + "'");
+        }
+        job.inputs.resize(spec->inputs);
+        for (int i = 0; i < spec->inputs; i++) {
+            if (!(tokens >> job.inputs[i])) {
+                throw std::runtime_error(where + job.operation + " expects " + std::to_string(spec->inputs) + " input file(s)");
+            }
+        }
+        if (spec->hasOutput && !(tokens >> job.output)) {
+            throw std::runtime_error(where + job.operation + " expects an output file");
+        }
+        job.params.resize(spec->params);
+        for (int i = 0; i < spec->params; i++) {
+            if (!(tokens >> job.params[i])) {
+                throw std::runtime_error(where + job.operation + " expects " + std::to_string(spec->params) + " numeric parameter(s)");
+            }
+        }
+
+        // 2. The message is the rest of the line; anything else left over is an error.
+        std::string rest;
+        std::getline(tokens >> std::ws, rest);
+        if (spec->hasMessage) {
+            job.message = rest;
+        } else if (!rest.empty()) {
+            throw std::runtime_error(where + "unexpected '" + rest + "'");
+        }
+
+        // 3. Kernel sizes and message lengths must be positive integers, kernels odd.
+        if (spec->params > 0) {
+            double first = job.params[0];
+            bool isKernel = job.operation != "reveal";
+            if (first < 1 || first != std::floor(first) || (isKernel && (long) first % 2 == 0)) {
+                throw std::runtime_error(where + (isKernel ? "kernel size must be a positive odd integer"
+                                                           : "message length must be a positive integer"));
+            }
+        }
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+// For each job, the earlier jobs it must wait for: the last writer of each file
+// it reads, and the last writer and every reader since of the file it writes.
+// Older writers and readers are ordered before those through their own waits.
+static std::vector<std::vector<size_t> > find_dependencies(const std::vector<BatchJob>& jobs) {
+    std::vector<std::vector<size_t> > dependencies(jobs.size());
+    std::map<std::string, size_t> lastWriter;
+    std::map<std::string, std::vector<size_t> > readers;
+    for (size_t j = 0; j < jobs.size(); j++) {
+        const BatchJob& job = jobs[j];
+        std::vector<size_t>& waits = dependencies[j];
+        for (size_t i = 0; i < job.inputs.size(); i++) {
+            std::map<std::string, size_t>::const_iterator writer = lastWriter.find(job.inputs[i]);
+            if (writer != lastWriter.end()) {
+                waits.push_back(writer->second);
+            }
+        }
+        if (!job.output.empty()) {
+            std::map<std::string, size_t>::const_iterator writer = lastWriter.find(job.output);
+            if (writer != lastWriter.end()) {
+                waits.push_back(writer->second);
+            }
+            std::vector<size_t>& pending = readers[job.output];
+            waits.insert(waits.end(), pending.begin(), pending.end());
+            pending.clear();
+            lastWriter[job.output] = j;
+        }
+        for (size_t i = 0; i < job.inputs.size(); i++) {
+            readers[job.inputs[i]].push_back(j);
+        }
+        std::sort(waits.begin(), waits.end());
+        waits.erase(std::unique(waits.begin(), waits.end()), waits.end());
+        waits.erase(std::remove(waits.begin(), waits.end(), j), waits.end());
+    }
+    return dependencies;
+}
+
+std::vector<BatchResult> BatchProcessor::run(const std::vector<BatchJob>& jobs, const BatchOptions& options) {
+    std::vector<BatchResult> results(jobs.size());
+    for (size_t i = 0; i < jobs.size(); i++) {
+        results[i].line = jobs[i].line;
+        results[i].operation = jobs[i].operation;
+        results[i].succeeded = true;
+    }
+
+    // Each job's result is only touched by the stage currently holding the job,
+    // so the stages need no lock around it. Once the job is marked finished,
+    // under finishedMutex, jobs waiting on it may read it.
+    std::vector<std::vector<size_t> > dependencies = find_dependencies(jobs);
+    std::vector<char> finished(jobs.size(), 0);
+    std::mutex finishedMutex;
+    std::condition_variable finishedChanged;
+    auto finish = [&](size_t i) {
+        std::lock_guard<std::mutex> lock(finishedMutex);
+        finished[i] = 1;
+        finishedChanged.notify_all();
+    };
+    auto wait_for_dependencies = [&](size_t i) {
+        std::unique_lock<std::mutex> lock(finishedMutex);
+        for (size_t d = 0; d < dependencies[i].size(); d++) {
+            size_t k = dependencies[i][d];
+            finishedChanged.wait(lock, [&]() { return finished[k] != 0; });
+            if (!results[k].succeeded) {
+                throw std::runtime_error("Depends on line " + std::to_string(jobs[k].line) + ", which failed");
+            }
+        }
+    };
+    int decodeThreads = std::max(1, options.decodeThreads);
+    int computeThreads = std::max(1, options.computeThreads);
+    int encodeThreads = std::max(1, options.encodeThreads);
+    BoundedQueue<BatchItem> decoded(options.queueCapacity);
+    BoundedQueue<BatchItem> computed(options.queueCapacity);
+    std::atomic<size_t> nextJob(0);
+    std::atomic<int> decoding(decodeThreads);
+    std::atomic<int> computing(computeThreads);
+    std::vector<std::thread> threads;
+
+    // 1. Decoders claim jobs in manifest order and hold each back until the jobs
+    //    it depends on have finished. Those are earlier jobs, already claimed, so
+    //    the waits cannot form a cycle. The last decoder to finish closes the queue.
+    for (int t = 0; t < decodeThreads; t++) {
+        threads.emplace_back([&]() {
+            for (size_t i; (i = nextJob++) < jobs.size();) {
+                BatchItem item;
+                item.index = i;
+                if (run_guarded(results[i], [&]() { wait_for_dependencies(i); decode_job(jobs[i], item); })) {
+                    decoded.push(std::move(item));
+                } else {
+                    finish(i);
+                }
+            }
+            if (--decoding == 0) {
+                decoded.close();
+            }
+        });
+    }
+
+    // 2. Compute workers take decoded jobs as they arrive.
+    for (int t = 0; t < computeThreads; t++) {
+        threads.emplace_back([&]() {
+            BatchItem item;
+            while (decoded.pop(item)) {
+                if (run_guarded(results[item.index], [&]() { compute_job(jobs[item.index], item); })) {
+                    computed.push(std::move(item));
+                } else {
+                    finish(item.index);
+                }
+            }
+            if (--computing == 0) {
+                computed.close();
+            }
+        });
+    }
+
+    // 3. Encoders write results while the earlier stages keep going.
+    for (int t = 0; t < encodeThreads; t++) {
+        threads.emplace_back([&]() {
+            BatchItem item;
+            while (computed.pop(item)) {
+                BatchResult& result = results[item.index];
+                run_guarded(result, [&]() { encode_job(jobs[item.index], item, result); });
+                finish(item.index);
+            }
+        });
+    }
+
+    for (size_t t = 0; t < threads.size(); t++) {
+        threads[t].join();
+    }
+    return results;
+}
+
+std::vector<BatchResult> BatchProcessor::run_manifest(const std::string& filename, const BatchOptions& options) {
+    return run(parse_manifest(filename), options);
+}
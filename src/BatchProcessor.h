@@ -0,0 +1,71 @@
+#ifndef BATCH_PROCESSOR_H
+#define BATCH_PROCESSOR_H
+
+#include <string>
+#include <vector>
+
+// One line of a batch manifest.
+struct BatchJob {
+    int line;                         // Manifest line, for reporting
+    std::string operation;
+    std::vector<std::string> inputs;
+    std::string output;               // Empty for "equals"
+    std::vector<double> params;
+    std::string message;              // Text to hide, for "disguise"
+};
+
+// Outcome of one job, in manifest order.
+struct BatchResult {
+    int line;
+    std::string operation;
+    bool succeeded;
+    std::string message;              // Error text, the comparison or the revealed message
+};
+
+struct BatchOptions {
+    int decodeThreads;   // Threads loading inputs
+    int computeThreads;  // Threads running operations; each filter also uses the shared pool
+    int encodeThreads;   // Threads writing outputs
+    int queueCapacity;   // Jobs allowed to wait between two stages
+
+    BatchOptions() : decodeThreads(2), computeThreads(1), encodeThreads(2), queueCapacity(4) {}
+};
+
+// Runs many image jobs in one process. Decoding, computing and encoding are
+// separate stages with their own threads, joined by bounded queues, so reading
+// the next inputs and writing the previous outputs overlap with filtering while
+// at most about 2 * queueCapacity + threads decoded jobs are held in memory.
+//
+// Jobs may chain through files. A job that reads a file an earlier job writes,
+// or writes a file an earlier job reads or writes, is not decoded until that
+// job has finished, and fails if that job failed. Paths are compared as
+// written, so "a.png" and "./a.png" count as different files. Jobs that share
+// no files run fully overlapped.
+//
+// The manifest has one job per line; blank lines and lines starting with '#' are
+// skipped:
+//
+//     mean      input.png output.png 3
+//     gaussian  input.png output.png 5 1.0
+//     unsharp   input.png output.png 3 1.5
+//     add       a.png b.png output.png
+//     subtract  a.png b.png output.png
+//     equals    a.png b.png
+//     disguise  cover.png secret.dat message text
+//     reveal    secret.dat message.txt 12
+class BatchProcessor {
+public:
+    // Reads a manifest, throwing std::runtime_error with the line number on the
+    // first malformed line.
+    static std::vector<BatchJob> parse_manifest(const std::string& filename);
+
+    // Runs the jobs. A failing job is reported in its result and does not stop
+    // the others.
+    static std::vector<BatchResult> run(const std::vector<BatchJob>& jobs,
+                                        const BatchOptions& options = BatchOptions());
+
+    static std::vector<BatchResult> run_manifest(const std::string& filename,
+                                                 const BatchOptions& options = BatchOptions());
+};
+
+#endif // BATCH_PROCESSOR_H
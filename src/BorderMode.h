@@ -0,0 +1,39 @@
+#ifndef BORDER_MODE_H
+#define BORDER_MODE_H
+
+// How filters read pixels beyond the image edge.
+enum BorderMode {
+    BORDER_ZERO,       // 000|abcd|000, the original behavior
+    BORDER_REPLICATE,  // aaa|abcd|ddd
+    BORDER_REFLECT,    // dcb|abcd|cba, mirrored about the edge pixel
+    BORDER_WRAP        // bcd|abcd|abc
+};
+
+// Maps a coordinate outside [0, size) to the pixel it reads, or -1 for a zero.
+// Coordinates inside the range map to themselves.
+inline int border_index(int index, int size, BorderMode border) {
+    if (index >= 0 && index < size) {
+        return index;
+    }
+    switch (border) {
+        case BORDER_REPLICATE:
+            return index < 0 ? 0 : size - 1;
+        case BORDER_REFLECT: {
+            if (size == 1) {
+                return 0;
+            }
+            int period = 2 * (size - 1);
+            int m = index % period;
+            m = m < 0 ? m + period : m;
+            return m < size ? m : period - m;
+        }
+        case BORDER_WRAP: {
+            int m = index % size;
+            return m < 0 ? m + size : m;
+        }
+        default:
+            return -1;
+    }
+}
+
+#endif // BORDER_MODE_H
@@ -0,0 +1,63 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <utility>
+
+// Blocking FIFO with a fixed capacity, used to hand work between pipeline stages.
+// Producers block while it is full, so a slow consumer caps how much is in flight.
+template <typename T>
+class BoundedQueue {
+private:
+    std::deque<T> items;
+    size_t capacity;
+    bool closed;
+    std::mutex mutex;
+    std::condition_variable notFull;
+    std::condition_variable notEmpty;
+
+public:
+    explicit BoundedQueue(size_t capacity) : capacity(capacity > 0 ? capacity : 1), closed(false) {}
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    // Waits for room and appends item. Returns false if the queue was closed.
+    bool push(T item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notFull.wait(lock, [this] { return closed || items.size() < capacity; });
+        if (closed) {
+            return false;
+        }
+        items.push_back(std::move(item));
+        notEmpty.notify_one();
+        return true;
+    }
+
+    // Waits for an item and moves it into item. Returns false once the queue is
+    // closed and drained.
+    bool pop(T& item) {
+        std::unique_lock<std::mutex> lock(mutex);
+        notEmpty.wait(lock, [this] { return closed || !items.empty(); });
+        if (items.empty()) {
+            return false;
+        }
+        item = std::move(items.front());
+        items.pop_front();
+        notFull.notify_one();
+        return true;
+    }
+
+    // No more items will be pushed; consumers finish what is queued.
+    void close() {
+        std::lock_guard<std::mutex> lock(mutex);
+        closed = true;
+        notFull.notify_all();
+        notEmpty.notify_all();
+    }
+};
+
+#endif // BOUNDED_QUEUE_H
@@ -0,0 +1,131 @@
+#include "BufferPool.h"
+#include <cstdlib>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+// Pool state. It is created on first use and never destroyed, so images released
+// by static destructors at exit still find it.
+struct PoolState {
+    std::mutex mutex;
+    std::unordered_map<size_t, std::vector<void*> > freeBlocks; // Keyed by class size
+    size_t cacheLimit;
+    BufferPoolStats stats;
+
+    PoolState() : cacheLimit((size_t) 256 << 20) {
+        stats.liveBytes = 0;
+        stats.peakBytes = 0;
+        stats.cachedBytes = 0;
+        stats.acquisitions = 0;
+        stats.hits = 0;
+    }
+};
+
+static PoolState& pool_state() {
+    static PoolState* state = new PoolState();
+    return *state;
+}
+
+// Rounds bytes up to its size class: 64 bytes at least, then 1, 1.25, 1.5 or
+// 1.75 times a power of two.
+static size_t class_size(size_t bytes) {
+    if (bytes <= BufferPool::ALIGNMENT) {
+        return BufferPool::ALIGNMENT;
+    }
+    size_t base = BufferPool::ALIGNMENT;
+    while (base * 2 < bytes) {
+        base *= 2;
+    }
+    size_t step = base / 4;
+    return base + (bytes - base + step - 1) / step * step;
+}
+
+// Frees cached blocks until the cache fits in limit. Called with the mutex held.
+static void shrink_cache(PoolState& state, size_t limit) {
+    for (auto it = state.freeBlocks.begin(); it != state.freeBlocks.end() && state.stats.cachedBytes > limit; ++it) {
+        std::vector<void*>& blocks = it->second;
+        while (!blocks.empty() && state.stats.cachedBytes > limit) {
+            free(blocks.back());
+            blocks.pop_back();
+            state.stats.cachedBytes -= it->first;
+        }
+    }
+}
+
+void* BufferPool::acquire(size_t bytes) {
+    if (bytes == 0) {
+        return nullptr;
+    }
+    size_t size = class_size(bytes);
+    PoolState& state = pool_state();
+
+    // 1. Reuse a cached block of the same class if there is one.
+    void* block = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.stats.acquisitions++;
+        std::vector<void*>& blocks = state.freeBlocks[size];
+        if (!blocks.empty()) {
+            block = blocks.back();
+            blocks.pop_back();
+            state.stats.cachedBytes -= size;
+            state.stats.hits++;
+        }
+        state.stats.liveBytes += size;
+        if (state.stats.liveBytes > state.stats.peakBytes) {
+            state.stats.peakBytes = state.stats.liveBytes;
+        }
+    }
+
+    // 2. Otherwise allocate outside the lock.
+    if (block == nullptr && posix_memalign(&block, ALIGNMENT, size) != 0) {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.stats.liveBytes -= size;
+        throw std::bad_alloc();
+    }
+    return block;
+}
+
+void BufferPool::release(void* block, size_t bytes) {
+    if (block == nullptr) {
+        return;
+    }
+    size_t size = class_size(bytes);
+    PoolState& state = pool_state();
+    {
+        std::lock_guard<std::mutex> lock(state.mutex);
+        state.stats.liveBytes -= size;
+        if (state.stats.cachedBytes + size <= state.cacheLimit) {
+            state.freeBlocks[size].push_back(block);
+            state.stats.cachedBytes += size;
+            return;
+        }
+    }
+    free(block);
+}
+
+void BufferPool::set_cache_limit(size_t bytes) {
+    PoolState& state = pool_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.cacheLimit = bytes;
+    shrink_cache(state, bytes);
+}
+
+void BufferPool::trim() {
+    PoolState& state = pool_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    shrink_cache(state, 0);
+}
+
+BufferPoolStats BufferPool::stats() {
+    PoolState& state = pool_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.stats;
+}
+
+void BufferPool::reset_peak() {
+    PoolState& state = pool_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.stats.peakBytes = state.stats.liveBytes;
+}
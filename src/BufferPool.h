@@ -0,0 +1,76 @@
+#ifndef BUFFER_POOL_H
+#define BUFFER_POOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+// Usage counters of the shared buffer pool.
+struct BufferPoolStats {
+    size_t liveBytes;        // Handed out and not yet released
+    size_t peakBytes;        // Highest liveBytes since start or reset_peak()
+    size_t cachedBytes;      // Released blocks kept for reuse
+    uint64_t acquisitions;
+    uint64_t hits;           // Acquisitions served from a cached block
+
+    double hit_rate() const { return acquisitions > 0 ? (double) hits / acquisitions : 0.0; }
+};
+
+// Process-wide pool of 64-byte aligned blocks for image pixels, secret image
+// arrays and filter scratch space. Released blocks are kept per size class and
+// handed out again, so a long-running service that filters images of similar
+// sizes stops going to the system allocator after warming up. Sizes are rounded
+// up to one of four classes per power of two, which wastes at most 25%.
+class BufferPool {
+public:
+    static const size_t ALIGNMENT = 64;
+
+    // Returns an uninitialized block of at least `bytes` bytes, or nullptr for 0.
+    // Throws std::bad_alloc when memory runs out.
+    static void* acquire(size_t bytes);
+
+    // Gives back a block from acquire(), with the same byte count. nullptr is ignored.
+    static void release(void* block, size_t bytes);
+
+    // Cached bytes above this limit are freed instead of kept (default 256 MiB).
+    static void set_cache_limit(size_t bytes);
+
+    // Frees every cached block.
+    static void trim();
+
+    static BufferPoolStats stats();
+    static void reset_peak();
+};
+
+// Scratch array of trivially copyable T drawn from the BufferPool and returned
+// to it when the buffer goes out of scope.
+template <typename T>
+class PooledBuffer {
+    static_assert(std::is_trivially_copyable<T>::value, "PooledBuffer holds trivially copyable types only");
+
+private:
+    T* items;
+    size_t count;
+
+public:
+    // The contents start uninitialized unless zeroed is set.
+    explicit PooledBuffer(size_t count, bool zeroed = false)
+        : items(static_cast<T*>(BufferPool::acquire(count * sizeof(T)))), count(count) {
+        if (zeroed && count > 0) {
+            std::memset(static_cast<void*>(items), 0, count * sizeof(T));
+        }
+    }
+    ~PooledBuffer() { BufferPool::release(items, count * sizeof(T)); }
+
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    T* data() { return items; }
+    const T* data() const { return items; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) { return items[i]; }
+    const T& operator[](size_t i) const { return items[i]; }
+};
+
+#endif // BUFFER_POOL_H
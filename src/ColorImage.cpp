@@ -0,0 +1,163 @@
+#include "ColorImage.h"
+#include "BufferPool.h"
+#include "TileExecutor.h"
+#include "Trace.h"
+#include "stb_image.h"
+#include "stb_image_write.h"
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+// Constructor: load from a file, keeping the file's channels
+ColorImage::ColorImage(const char* filename) {
+    // 1. Decode with the channel count stored in the file.
+    ScopedTimer timer("image.decode");
+    int channels, w, h;
+    unsigned char* image = stbi_load(filename, &w, &h, &channels, 0);
+    if (image == nullptr) {
+        throw std::runtime_error(std::string("Could not load image ") + filename);
+    }
+    timer.set_pixels((uint64_t) w * h);
+    timer.set_bytes((uint64_t) w * h * channels);
+
+    // 2. Split the interleaved rows into one plane per channel.
+    width = w;
+    height = h;
+    for (int c = 0; c < channels; c++) {
+        planes.emplace_back(w, h);
+    }
+    TileExecutor::for_each_band(h, 0, [&](const RowBand& band) {
+        for (int i = band.begin; i < band.end; i++) {
+            const unsigned char* source = image + (size_t) i * w * channels;
+            for (int c = 0; c < channels; c++) {
+                uint8_t* out = planes[c].row(i);
+                for (int j = 0; j < w; j++) {
+                    out[j] = source[(size_t) j * channels + c];
+                }
+            }
+        }
+    });
+    stbi_image_free(image);
+}
+
+// Constructor to create a blank image
+ColorImage::ColorImage(int w, int h, int channels) : width(w), height(h) {
+    if (channels < 1 || channels > MAX_CHANNELS) {
+        throw std::invalid_argument("A color image has 1 to 4 channels.");
+    }
+    for (int c = 0; c < channels; c++) {
+        planes.emplace_back(w, h);
+    }
+}
+
+// Constructor: adopt existing planes
+ColorImage::ColorImage(std::vector<GrayscaleImage>&& channelPlanes) : planes(std::move(channelPlanes)) {
+    if (planes.empty() || planes.size() > (size_t) MAX_CHANNELS) {
+        throw std::invalid_argument("A color image has 1 to 4 channels.");
+    }
+    width = planes[0].get_width();
+    height = planes[0].get_height();
+    for (size_t c = 1; c < planes.size(); c++) {
+        if (planes[c].get_width() != width || planes[c].get_height() != height) {
+            throw std::invalid_argument("Every channel must have the same dimensions.");
+        }
+    }
+}
+
+// Move constructor: takes over the planes, leaving other empty
+ColorImage::ColorImage(ColorImage&& other) noexcept
+    : planes(std::move(other.planes)), width(other.width), height(other.height) {
+    other.width = 0;
+    other.height = 0;
+}
+
+// Move assignment
+ColorImage& ColorImage::operator=(ColorImage&& other) noexcept {
+    if (this != &other) {
+        planes.swap(other.planes);
+        other.planes.clear();
+        width = other.width;
+        height = other.height;
+        other.width = 0;
+        other.height = 0;
+    }
+    return *this;
+}
+
+// Equality operator
+bool ColorImage::operator==(const ColorImage& other) const {
+    if (planes.size() != other.planes.size()) {
+        return false;
+    }
+    for (size_t c = 0; c < planes.size(); c++) {
+        if (!(planes[c] == other.planes[c])) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Throws unless other has the same dimensions and channels.
+static void check_same_shape(const ColorImage& image, const ColorImage& other, const char* message) {
+    if (image.get_width() != other.get_width() || image.get_height() != other.get_height() ||
+        image.get_channels() != other.get_channels()) {
+        throw std::invalid_argument(message);
+    }
+}
+
+// Addition operator
+ColorImage ColorImage::operator+(const ColorImage& other) const {
+    ColorImage result(*this);
+    result += other;
+    return result;
+}
+
+// Subtraction operator
+ColorImage ColorImage::operator-(const ColorImage& other) const {
+    ColorImage result(*this);
+    result -= other;
+    return result;
+}
+
+// In-place addition, clamping at 255
+ColorImage& ColorImage::operator+=(const ColorImage& other) {
+    check_same_shape(*this, other, "Images must have the same dimensions and channels to be added.");
+    for (size_t c = 0; c < planes.size(); c++) {
+        planes[c] += other.planes[c];
+    }
+    return *this;
+}
+
+// In-place subtraction, clamping at 0
+ColorImage& ColorImage::operator-=(const ColorImage& other) {
+    check_same_shape(*this, other, "Images must have the same dimensions and channels to be subtracted.");
+    for (size_t c = 0; c < planes.size(); c++) {
+        planes[c] -= other.planes[c];
+    }
+    return *this;
+}
+
+// Function to save the image to a PNG file
+bool ColorImage::save_to_file(const char* filename) const {
+    // Interleave the planes into the layout stbi writes.
+    int channels = get_channels();
+    ScopedTimer timer("image.encode", (uint64_t) width * height, (uint64_t) width * height * channels);
+    PooledBuffer<uint8_t> interleaved((size_t) width * height * channels);
+    TileExecutor::for_each_band(height, 0, [&](const RowBand& band) {
+        for (int i = band.begin; i < band.end; i++) {
+            uint8_t* out = &interleaved[(size_t) i * width * channels];
+            for (int c = 0; c < channels; c++) {
+                const uint8_t* source = planes[c].row(i);
+                for (int j = 0; j < width; j++) {
+                    out[(size_t) j * channels + c] = source[j];
+                }
+            }
+        }
+    });
+    if (!stbi_write_png(filename, width, height, channels, interleaved.data(), width * channels)) {
+        std::cerr << "Error: Could not save image to file " << filename << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,61 @@
+#ifndef COLOR_IMAGE_H
+#define COLOR_IMAGE_H
+
+#include <vector>
+
+#include "GrayscaleImage.h"
+
+// Image with one to four 8-bit channels (grey, grey + alpha, RGB, RGBA) stored
+// planar: each channel is a GrayscaleImage of its own, so every row-level kernel
+// written for grayscale runs on a channel unchanged. Files are decoded with
+// their own channel count instead of being converted to grey.
+class ColorImage {
+private:
+    std::vector<GrayscaleImage> planes;
+    int width, height;
+
+public:
+    static const int MAX_CHANNELS = 4;
+
+    // Constructor: loads an image from a file, keeping its channels. Throws
+    // std::runtime_error if it cannot be decoded.
+    ColorImage(const char* filename);
+
+    // Constructor: a black image with the given size and channel count (1 to 4).
+    // Throws std::invalid_argument for other channel counts.
+    ColorImage(int w, int h, int channels);
+
+    // Constructor: takes over one GrayscaleImage per channel. Throws
+    // std::invalid_argument unless there are 1 to 4 planes of the same size.
+    explicit ColorImage(std::vector<GrayscaleImage>&& channelPlanes);
+
+    // Copy and move come from the planes.
+    ColorImage(const ColorImage& other) = default;
+    ColorImage(ColorImage&& other) noexcept;
+    ColorImage& operator=(const ColorImage& other) = default;
+    ColorImage& operator=(ColorImage&& other) noexcept;
+
+    // Operator overloads, channel by channel, with GrayscaleImage's saturation.
+    // The channel counts must match as well as the dimensions.
+    bool operator==(const ColorImage& other) const;
+    ColorImage operator+(const ColorImage& other) const;
+    ColorImage operator-(const ColorImage& other) const;
+    ColorImage& operator+=(const ColorImage& other);
+    ColorImage& operator-=(const ColorImage& other);
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    int get_channels() const { return (int) planes.size(); }
+
+    // The plane holding one channel
+    GrayscaleImage& plane(int channel) { return planes[channel]; }
+    const GrayscaleImage& plane(int channel) const { return planes[channel]; }
+
+    int get_pixel(int row, int col, int channel) const { return planes[channel].get_pixel(row, col); }
+    void set_pixel(int row, int col, int channel, int value) { planes[channel].set_pixel(row, col, value); }
+
+    // Writes the channels interleaved to a PNG file; returns false if it failed
+    bool save_to_file(const char* filename) const;
+};
+
+#endif // COLOR_IMAGE_H
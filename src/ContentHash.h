@@ -0,0 +1,42 @@
+#ifndef CONTENT_HASH_H
+#define CONTENT_HASH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Full-avalanche mix of one 64-bit value (the splitmix64 finalizer). Every input
+// bit changes each output bit with probability close to one half, and the mix is
+// a bijection, so no two inputs map to the same value.
+inline uint64_t content_hash_mix(uint64_t value) {
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    return value ^ (value >> 31);
+}
+
+// 64-bit hash of size bytes, continuing from seed so a long input can be hashed
+// in pieces. Each 64-bit word goes through a full mix before the next is folded
+// in, so differences in several words cannot cancel out, as they can when words
+// are only multiplied in (a multiply never carries high bits downward). Used for
+// the result cache keys and the binary file checksums.
+inline uint64_t content_hash(const void* data, size_t size, uint64_t seed = 0) {
+    const uint8_t* bytes = static_cast<const uint8_t*>(data);
+    uint64_t hash = seed ^ 0x9e3779b97f4a7c15ULL;
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word;
+        std::memcpy(&word, bytes + i, 8);
+        hash = content_hash_mix(hash ^ word);
+    }
+    if (i < size) {
+        uint64_t word = 0;
+        std::memcpy(&word, bytes + i, size - i);
+        hash = content_hash_mix(hash ^ word);
+    }
+    // The length goes in last, so inputs that differ only by trailing zeros differ.
+    return content_hash_mix(hash ^ (uint64_t) size);
+}
+
+#endif // CONTENT_HASH_H
@@ -0,0 +1,170 @@
+#include "ConvolutionKernel.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <stdexcept>
+
+// Largest denominator tried when looking for integer weights.
+static const int MAX_INTEGER_DIVISOR = 1024;
+
+// Relative tolerance for treating a weight as an integer or as rank-1.
+static const double WEIGHT_TOLERANCE = 1e-9;
+
+static int gcd(int a, int b) {
+    while (b != 0) {
+        int t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+ConvolutionKernel::ConvolutionKernel(int width, int height, const std::vector<double>& weights, double divisor)
+    : width(width), height(height), weights(weights), integral(false), integerDivisor(1), separable(false),
+      separableError(0) {
+    if (width <= 0 || height <= 0 || width % 2 == 0 || height % 2 == 0) {
+        throw std::invalid_argument("Kernel width and height must be positive and odd.");
+    }
+    if (weights.size() != (size_t) width * height) {
+        throw std::invalid_argument("Kernel must have width * height weights.");
+    }
+    if (divisor == 0) {
+        throw std::invalid_argument("Kernel divisor must not be zero.");
+    }
+    for (size_t i = 0; i < this->weights.size(); i++) {
+        this->weights[i] /= divisor;
+    }
+    find_integer_weights();
+    factorize();
+}
+
+// Looks for the smallest d such that every weight times d is an integer, and keeps
+// the integer form if a full tap sum over 8-bit pixels fits in 32 bits.
+void ConvolutionKernel::find_integer_weights() {
+    for (int d = 1; d <= MAX_INTEGER_DIVISOR; d++) {
+        std::vector<int> scaled(weights.size());
+        double absoluteSum = 0;
+        bool exact = true;
+        for (size_t i = 0; i < weights.size() && exact; i++) {
+            double value = weights[i] * d;
+            double rounded = std::floor(value + 0.5);
+            exact = std::fabs(value - rounded) <= WEIGHT_TOLERANCE * std::max(1.0, std::fabs(value));
+            scaled[i] = (int) rounded;
+            absoluteSum += std::fabs(rounded);
+        }
+        if (exact) {
+            if (absoluteSum * 255 <= INT_MAX) {
+                integral = true;
+                integerWeights = scaled;
+                integerDivisor = d;
+            }
+            return;
+        }
+    }
+}
+
+// Rank-1 factorization. The row through the largest weight is the row vector and
+// each row's ratio to it at the pivot column is the column vector; the kernel is
+// separable if that reproduces every weight within the tolerance. What is left
+// over bounds how far the separable sums can stray, so Filter::convolve can
+// widen the margin it re-checks near integers by it.
+void ConvolutionKernel::factorize() {
+    if (width == 1 || height == 1) {
+        return;
+    }
+    size_t pivot = 0;
+    for (size_t i = 1; i < weights.size(); i++) {
+        if (std::fabs(weights[i]) > std::fabs(weights[pivot])) {
+            pivot = i;
+        }
+    }
+    double largest = std::fabs(weights[pivot]);
+    if (largest == 0) {
+        return;
+    }
+    int p = (int) (pivot / width);
+    int q = (int) (pivot % width);
+    std::vector<double> column(height), row(weights.begin() + (size_t) p * width, weights.begin() + (size_t) (p + 1) * width);
+    double residual = 0;
+    for (int a = 0; a < height; a++) {
+        column[a] = weights[(size_t) a * width + q] / weights[pivot];
+        for (int b = 0; b < width; b++) {
+            double deviation = std::fabs(weights[(size_t) a * width + b] - column[a] * row[b]);
+            if (deviation > WEIGHT_TOLERANCE * largest) {
+                return;
+            }
+            residual += deviation;
+        }
+    }
+    separable = true;
+    separableError = 255 * residual;
+    columnWeights = column;
+    rowWeights = row;
+
+    // Integer factors: a rank-1 integer matrix is a multiple of its first nonzero
+    // row divided by that row's gcd, with integer multiples.
+    if (!integral) {
+        return;
+    }
+    const int* first = nullptr;
+    for (int a = 0; a < height && first == nullptr; a++) {
+        for (int b = 0; b < width; b++) {
+            if (integerWeights[(size_t) a * width + b] != 0) {
+                first = &integerWeights[(size_t) a * width];
+                break;
+            }
+        }
+    }
+    int divisor = 0;
+    int lead = 0;
+    for (int b = 0; b < width; b++) {
+        divisor = gcd(divisor, std::abs(first[b]));
+        if (first[b] != 0 && first[lead] == 0) {
+            lead = b;
+        }
+    }
+    std::vector<int> integerRowFactor(width), integerColumnFactor(height);
+    for (int b = 0; b < width; b++) {
+        integerRowFactor[b] = first[b] / divisor;
+    }
+    for (int a = 0; a < height; a++) {
+        const int* values = &integerWeights[(size_t) a * width];
+        if (values[lead] % integerRowFactor[lead] != 0) {
+            return;
+        }
+        integerColumnFactor[a] = values[lead] / integerRowFactor[lead];
+        for (int b = 0; b < width; b++) {
+            if (values[b] != integerColumnFactor[a] * integerRowFactor[b]) {
+                return;
+            }
+        }
+    }
+    integerRow = integerRowFactor;
+    integerColumn = integerColumnFactor;
+}
+
+ConvolutionKernel ConvolutionKernel::box(int size) {
+    return ConvolutionKernel(size, size, std::vector<double>((size_t) size * size, 1.0), (double) size * size);
+}
+
+ConvolutionKernel ConvolutionKernel::sobel_x() {
+    const double weights[] = { -1, 0, 1,
+                               -2, 0, 2,
+                               -1, 0, 1 };
+    return ConvolutionKernel(3, 3, std::vector<double>(weights, weights + 9));
+}
+
+ConvolutionKernel ConvolutionKernel::sobel_y() {
+    const double weights[] = { -1, -2, -1,
+                                0,  0,  0,
+                                1,  2,  1 };
+    return ConvolutionKernel(3, 3, std::vector<double>(weights, weights + 9));
+}
+
+ConvolutionKernel ConvolutionKernel::laplacian() {
+    const double weights[] = { 0,  1, 0,
+                               1, -4, 1,
+                               0,  1, 0 };
+    return ConvolutionKernel(3, 3, std::vector<double>(weights, weights + 9));
+}
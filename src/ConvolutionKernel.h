@@ -0,0 +1,74 @@
+#ifndef CONVOLUTION_KERNEL_H
+#define CONVOLUTION_KERNEL_H
+
+#include <vector>
+
+// User-supplied convolution weights of odd width and height, analyzed once when
+// the kernel is built so Filter::convolve can pick the cheapest path:
+//
+// - integral: every weight is an integer multiple of 1 / integer divisor (Sobel,
+//   Laplacian, box, binomial...). These run on 32-bit integer accumulators, and
+//   the sum is divided by the divisor exactly, so the result is the true rational
+//   sum truncated. The double sum of the divided weights can fall just below an
+//   integer and truncate one lower; the integer result is the one returned.
+// - separable: the weights are the outer product of a column and a row vector,
+//   found by rank-1 factorization, so two 1D passes replace the 2D one.
+//
+// The result of a tap sum is divided by the divisor, truncated toward zero and
+// clamped to [0, 255], like the built-in filters. Kernels that are not integral
+// give the direct double sum, also when they run as two separable passes.
+// Kernels are applied as correlation, i.e. weight (a, b) multiplies the pixel at
+// offset (a - height / 2, b - width / 2), which matches the usual Sobel tables.
+class ConvolutionKernel {
+private:
+    int width, height;
+    std::vector<double> weights;         // Row-major, already divided by the divisor
+
+    bool integral;
+    std::vector<int> integerWeights;     // weights * integerDivisor, when integral
+    int integerDivisor;
+
+    bool separable;
+    std::vector<double> columnWeights;   // weights(a, b) == columnWeights[a] * rowWeights[b]
+    std::vector<double> rowWeights;
+    double separableError;               // 255 * sum of |weights(a, b) - column * row|
+    std::vector<int> integerColumn;      // Same, for integerWeights, when both hold
+    std::vector<int> integerRow;
+
+    void find_integer_weights();
+    void factorize();
+
+public:
+    // Weights are row-major, width * height of them, and each is divided by divisor.
+    // Throws std::invalid_argument for even or non-positive sizes, a wrong weight
+    // count or a zero divisor.
+    ConvolutionKernel(int width, int height, const std::vector<double>& weights, double divisor = 1.0);
+
+    // Common kernels
+    static ConvolutionKernel box(int size);   // Mean over size x size pixels
+    static ConvolutionKernel sobel_x();       // Horizontal gradient
+    static ConvolutionKernel sobel_y();       // Vertical gradient
+    static ConvolutionKernel laplacian();     // 4-neighbour Laplacian
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+    const std::vector<double>& get_weights() const { return weights; }
+
+    bool is_integral() const { return integral; }
+    const std::vector<int>& get_integer_weights() const { return integerWeights; }
+    int get_integer_divisor() const { return integerDivisor; }
+
+    bool is_separable() const { return separable; }
+    bool is_integer_separable() const { return separable && !integerRow.empty(); }
+    const std::vector<double>& get_column_weights() const { return columnWeights; }
+    const std::vector<double>& get_row_weights() const { return rowWeights; }
+
+    // Most a separable tap sum over 8-bit pixels can differ from the direct 2D sum
+    // because the factors only reproduce the weights to within a tolerance, before
+    // any rounding. Zero for kernels that are not separable.
+    double get_separable_error() const { return separableError; }
+    const std::vector<int>& get_integer_column() const { return integerColumn; }
+    const std::vector<int>& get_integer_row() const { return integerRow; }
+};
+
+#endif // CONVOLUTION_KERNEL_H
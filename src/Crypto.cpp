@@ -1,133 +1,262 @@
 #include "Crypto.h"
 #include "GrayscaleImage.h"
+#include "Trace.h"
+#include <cstring>
 
+// Each character is stored as 7 bits, most significant first.
+static const int BITS_PER_CHARACTER = 7;
 
-// Extract the least significant bits (LSBs) from SecretImage, calculating x, y based on message length
-std::vector<int> Crypto::extract_LSBits(SecretImage& secret_image, int message_length) {
-    std::vector<int> LSB_array;
-
-    // 1. Reconstruct the SecretImage to a GrayscaleImage.
-    GrayscaleImage reconstructed_image = secret_image.reconstruct();
+// Table of every 7-bit value with its bits in reverse order. Characters are
+// stored most significant bit first, while BitBuffer fills bytes from bit 0.
+struct ReversedBits {
+    uint8_t table[128];
 
-    // 2. Calculate the image dimensions.
-    int height = reconstructed_image.get_height();;
-    int width = reconstructed_image.get_width();
+    ReversedBits() {
+        for (int value = 0; value < 128; value++) {
+            int reversed = 0;
+            for (int bit = 0; bit < BITS_PER_CHARACTER; bit++) {
+                reversed |= ((value >> bit) & 1) << (BITS_PER_CHARACTER - 1 - bit);
+            }
+            table[value] = static_cast<uint8_t>(reversed);
+        }
+    }
+};
 
-    // 3. Determine the total bits required based on message length.
-    int totalBitsMessage = message_length * 7;
-    int totalPixels = height * width;
+// Built on first use, so it is also ready for callers running during static initialization.
+static const ReversedBits& reversed_bits() {
+    static const ReversedBits table;
+    return table;
+}
 
-    // 4. Ensure the image has enough pixels; if not, throw an error.
-    if (totalPixels < totalBitsMessage) {
-        throw std::length_error("The image does not have enough pixels.");
-    }
+// Gathers the LSBs of eight pixels into one byte, pixel 0 into bit 0.
+static inline uint8_t gather_lsbs(const uint8_t* pixels) {
+    uint64_t word;
+    std::memcpy(&word, pixels, 8);
+    return static_cast<uint8_t>(((word & 0x0101010101010101ULL) * 0x0102040810204080ULL) >> 56);
+}
 
-    // 5. Calculate the starting pixel from the message_length knowing that  
-    //    the last LSB to extract is in the last pixel of the image.
-    int startingIndex = totalPixels - totalBitsMessage;
-    int startingRow = startingIndex / width;
-    int startingColumn = startingIndex % width;
+// Spreads the bits of one byte over the LSBs of eight pixels, bit 0 into pixel 0.
+static inline void scatter_lsbs(uint8_t bits, uint8_t* pixels) {
+    uint64_t spread = (bits * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+    spread = ((spread + 0x7F7F7F7F7F7F7F7FULL) >> 7) & 0x0101010101010101ULL;
+    uint64_t word;
+    std::memcpy(&word, pixels, 8);
+    word = (word & 0xFEFEFEFEFEFEFEFEULL) | spread;
+    std::memcpy(pixels, &word, 8);
+}
 
-    // 6. Extract LSBs from the image pixels and return the result.
-    for (int i = startingRow; i < height; i++) {
-        for (int j = (i == startingRow ? startingColumn : 0 ); j < width; j++) {
-            int pixelValue = reconstructed_image.get_pixel(i,j) ;
-            int lsb = pixelValue % 2;
-            LSB_array.push_back(lsb);
+// ORs the LSBs of count pixels into a zeroed bit buffer, starting at bit `position`.
+static void pack_lsbs(const uint8_t* pixels, size_t count, uint8_t* bytes, size_t position) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, position += 8) {
+        uint8_t bits = gather_lsbs(pixels + i);
+        int shift = position % 8;
+        bytes[position / 8] |= static_cast<uint8_t>(bits << shift);
+        if (shift != 0) {
+            bytes[position / 8 + 1] |= static_cast<uint8_t>(bits >> (8 - shift));
         }
-        if (LSB_array.size() == totalBitsMessage) {
-            return LSB_array;
+    }
+    for (; i < count; i++, position++) {
+        bytes[position / 8] |= static_cast<uint8_t>((pixels[i] & 1) << (position % 8));
+    }
+}
+
+// Writes count bits, starting at bit `position`, into the LSBs of count pixels.
+static void unpack_lsbs(const uint8_t* bytes, size_t position, uint8_t* pixels, size_t count) {
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8, position += 8) {
+        int shift = position % 8;
+        unsigned int bits = bytes[position / 8] >> shift;
+        if (shift != 0) {
+            bits |= (unsigned int) bytes[position / 8 + 1] << (8 - shift);
         }
+        scatter_lsbs(static_cast<uint8_t>(bits), pixels + i);
+    }
+    for (; i < count; i++, position++) {
+        int bit = (bytes[position / 8] >> (position % 8)) & 1;
+        pixels[i] = static_cast<uint8_t>((pixels[i] & ~1) | bit);
     }
+}
 
-    return LSB_array;
+// Extract the LSBs from SecretImage into a packed bit buffer
+BitBuffer Crypto::extract_LSB_bits(SecretImage& secret_image, int message_length) {
+    // 1. Calculate the image dimensions.
+    int height = secret_image.get_height();
+    int width = secret_image.get_width();
+
+    // 2. Determine the total bits required based on message length.
+    size_t totalBitsMessage = (size_t) message_length * BITS_PER_CHARACTER;
+    size_t totalPixels = (size_t) height * width;
+
+    // 3. Ensure the image has enough pixels; if not, throw an error.
+    if (totalPixels < totalBitsMessage) {
+        throw std::length_error("The image does not have enough pixels.");
+    }
+    ScopedTimer timer("crypto.extract", totalBitsMessage, totalBitsMessage);
+
+    // 4. The message ends at the last pixel of the image. Read the LSBs straight
+    //    from the triangular arrays, eight pixels per word, without reconstructing.
+    BitBuffer bits;
+    bits.bit_count = totalBitsMessage;
+    bits.bytes.assign((totalBitsMessage + 7) / 8, 0);
+    size_t position = 0;
+    secret_image.for_each_run(totalPixels - totalBitsMessage, totalPixels, [&](const uint8_t* run, size_t length) {
+        pack_lsbs(run, length, bits.bytes.data(), position);
+        position += length;
+    });
+    return bits;
 }
 
-// Decrypt message by converting LSB array into ASCII characters
-std::string Crypto::decrypt_message(const std::vector<int>& LSB_array) {
-    std::string message;
-    // 1. Verify that the LSB array size is a multiple of 7, else throw an error.
-    if (LSB_array.size() % 7 != 0) {
+// Decrypt a message from packed bits, 7 bits per ASCII character
+std::string Crypto::decrypt_message_bits(const BitBuffer& bits) {
+    // 1. Verify that the bit count is a multiple of 7, else throw an error.
+    if (bits.bit_count % BITS_PER_CHARACTER != 0) {
         throw std::length_error("LSB array size must be multiple of 7.");
     }
 
-    // 2. Convert each group of 7 bits into an ASCII character.
-    // 3. Collect the characters to form the decrypted message.
-    for (size_t i = 0; i < LSB_array.size(); i += 7) {
-        int asciiValue = 0;
-        for (int j = 0; j < 7; ++j) {
-            if (LSB_array[i + j]) {
-                int value = 1 ;
-                for (int i = 1; i <= (6-j); i++) {
-                    value *= 2;
-                }
-                asciiValue += value;
-            }
+    // 2. Stream the bytes through a 64-bit window and cut off 7 bits per character.
+    std::string message;
+    message.reserve(bits.bit_count / BITS_PER_CHARACTER);
+    uint64_t window = 0;
+    int available = 0;
+    size_t byteIndex = 0;
+    for (size_t c = 0; c < bits.bit_count / BITS_PER_CHARACTER; c++) {
+        while (available < BITS_PER_CHARACTER) {
+            window |= (uint64_t) bits.bytes[byteIndex++] << available;
+            available += 8;
         }
-        char character = (char) asciiValue;
-        message += character;
+        message += (char) reversed_bits().table[window & 0x7F];
+        window >>= BITS_PER_CHARACTER;
+        available -= BITS_PER_CHARACTER;
     }
-
-    // 4. Return the resulting message.
     return message;
 }
 
-// Encrypt message by converting ASCII characters into LSBs
-std::vector<int> Crypto::encrypt_message(const std::string& message) {
-    std::vector<int> LSB_array;
-
-    // 1. Convert each character of the message into a 7-bit binary representation.
-    //    You can use std::bitset.
-    // 2. Collect the bits into the LSB array.
-    for (char character : message) {
-        std::bitset<7> binary(character);
-        for (int i = 6; i >= 0; i--) {
-            LSB_array.push_back(binary[i]);
+// Encrypt a message into packed bits, 7 bits per ASCII character
+BitBuffer Crypto::encrypt_message_bits(const std::string& message) {
+    BitBuffer bits;
+    bits.bit_count = message.size() * BITS_PER_CHARACTER;
+    bits.bytes.reserve((bits.bit_count + 7) / 8);
+
+    // Append each character's 7 bits (most significant first) to a 64-bit window
+    // and flush it a byte at a time.
+    uint64_t window = 0;
+    int pending = 0;
+    for (size_t c = 0; c < message.size(); c++) {
+        window |= (uint64_t) reversed_bits().table[message[c] & 0x7F] << pending;
+        pending += BITS_PER_CHARACTER;
+        while (pending >= 8) {
+            bits.bytes.push_back(static_cast<uint8_t>(window));
+            window >>= 8;
+            pending -= 8;
         }
     }
-
-    // 3. Return the array of bits.
-    return LSB_array;
+    if (pending > 0) {
+        bits.bytes.push_back(static_cast<uint8_t>(window));
+    }
+    return bits;
 }
 
-SecretImage Crypto::embed_LSBits(GrayscaleImage& image, const std::vector<int>& LSB_array) {
-
+// Embed packed bits into the LSBs of the image, ending at the last pixel
+SecretImage Crypto::embed_LSB_bits(GrayscaleImage& image, const BitBuffer& bits) {
     int height = image.get_height();
     int width = image.get_width();
-    int maxSize =height * width;
-    int LSB_size = LSB_array.size();
+    size_t maxSize = (size_t) height * width;
 
-    // 1. Ensure the image has enough pixels to store the LSB array, else throw an error.
-    if(LSB_size > maxSize) {
-        throw std :: length_error("The image does not have enough pixels.");
+    // 1. Ensure the image has enough pixels to store the bits, else throw an error.
+    if (bits.bit_count > maxSize) {
+        throw std::length_error("The image does not have enough pixels.");
+    }
+    ScopedTimer timer("crypto.embed", bits.bit_count, bits.bit_count);
+
+    // An empty message changes nothing, and a zero-width image has no row to
+    // start in.
+    if (bits.bit_count == 0) {
+        return SecretImage(image);
     }
 
     // 2. Find the starting pixel based on the message length knowing that
     //    the last LSB to embed should end up in the last pixel of the image.
-    int startingIndex = maxSize - LSB_size;
-    int startingRow = startingIndex / height;
-    int startingColumn = startingIndex % height;
-    int lsbIndex = 0;
-
-    // 3. Iterate over the image pixels, embedding LSBs from the array.
-    for (int i = startingRow; i < height; i++) {
-        for (int j = (i == startingRow ? startingColumn : 0); j < width; j++) {
-            if (lsbIndex >= LSB_size) {
-                break;
-            }
-            int pixel = image.get_pixel(i, j);
-            if(LSB_array[lsbIndex] == 1) {
-                pixel |= 1;
-            }else {
-                pixel &= ~1;
-            }
-            image.set_pixel(i, j, pixel);
-            lsbIndex ++;
-        }
+    size_t startingIndex = maxSize - bits.bit_count;
+    int startingRow = (int) (startingIndex / width);
+    int startingColumn = (int) (startingIndex % width);
+
+    // 3. Write the bits into each remaining row segment, eight pixels per word.
+    size_t position = 0;
+    for (int i = startingRow; i < height && position < bits.bit_count; i++) {
+        int column = (i == startingRow ? startingColumn : 0);
+        unpack_lsbs(bits.bytes.data(), position, image.row(i) + column, width - column);
+        position += width - column;
     }
-    SecretImage secret_image(image);
 
     // 4. Return a SecretImage object constructed from the given GrayscaleImage
     //    with the embedded message.
+    SecretImage secret_image(image);
     return secret_image;
 }
+
+// Embed packed bits into the LSBs of a SecretImage in place, ending at the last pixel
+void Crypto::embed_LSB_bits(SecretImage& secret_image, const BitBuffer& bits) {
+    size_t maxSize = (size_t) secret_image.get_height() * secret_image.get_width();
+
+    // 1. Ensure the image has enough pixels to store the bits, else throw an error.
+    if (bits.bit_count > maxSize) {
+        throw std::length_error("The image does not have enough pixels.");
+    }
+    ScopedTimer timer("crypto.embed", bits.bit_count, bits.bit_count);
+
+    // 2. Write the bits straight into the triangular arrays.
+    size_t position = 0;
+    secret_image.for_each_run(maxSize - bits.bit_count, maxSize, [&](uint8_t* run, size_t length) {
+        unpack_lsbs(bits.bytes.data(), position, run, length);
+        position += length;
+    });
+}
+
+// Extract the least significant bits (LSBs) from SecretImage, calculating x, y based on message length
+std::vector<int> Crypto::extract_LSBits(SecretImage& secret_image, int message_length) {
+    BitBuffer bits = extract_LSB_bits(secret_image, message_length);
+    std::vector<int> LSB_array(bits.bit_count);
+    for (size_t k = 0; k < bits.bit_count; k++) {
+        LSB_array[k] = (bits.bytes[k / 8] >> (k % 8)) & 1;
+    }
+    return LSB_array;
+}
+
+// Decrypt message by converting LSB array into ASCII characters
+std::string Crypto::decrypt_message(const std::vector<int>& LSB_array) {
+    // Any non-zero entry counts as a set bit.
+    BitBuffer bits;
+    bits.bit_count = LSB_array.size();
+    bits.bytes.assign((LSB_array.size() + 7) / 8, 0);
+    for (size_t k = 0; k < LSB_array.size(); k++) {
+        if (LSB_array[k]) {
+            bits.bytes[k / 8] |= static_cast<uint8_t>(1 << (k % 8));
+        }
+    }
+    return decrypt_message_bits(bits);
+}
+
+// Encrypt message by converting ASCII characters into LSBs
+std::vector<int> Crypto::encrypt_message(const std::string& message) {
+    BitBuffer bits = encrypt_message_bits(message);
+    std::vector<int> LSB_array(bits.bit_count);
+    for (size_t k = 0; k < bits.bit_count; k++) {
+        LSB_array[k] = (bits.bytes[k / 8] >> (k % 8)) & 1;
+    }
+    return LSB_array;
+}
+
+// Embed an LSB array into the image and return it as a SecretImage
+SecretImage Crypto::embed_LSBits(GrayscaleImage& image, const std::vector<int>& LSB_array) {
+    // Only entries equal to 1 set a bit; everything else clears it.
+    BitBuffer bits;
+    bits.bit_count = LSB_array.size();
+    bits.bytes.assign((LSB_array.size() + 7) / 8, 0);
+    for (size_t k = 0; k < LSB_array.size(); k++) {
+        if (LSB_array[k] == 1) {
+            bits.bytes[k / 8] |= static_cast<uint8_t>(1 << (k % 8));
+        }
+    }
+    return embed_LSB_bits(image, bits);
+}
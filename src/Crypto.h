@@ -9,6 +9,14 @@
 #include <iostream>
 #include <algorithm>
 
+// Bits packed eight per byte: bit k of the stream is bit (k % 8) of bytes[k / 8].
+struct BitBuffer {
+    std::vector<uint8_t> bytes;
+    size_t bit_count;
+
+    BitBuffer() : bit_count(0) {}
+};
+
 class Crypto {
 public:
     // Function to extract LSBs from SecretImage
@@ -22,6 +30,18 @@ public:
 
     // Function to embed LSB array into SecretImage
     static SecretImage embed_LSBits(GrayscaleImage& image, const std::vector<int>& LSB_array);
+
+    // Bit-packed versions of the functions above. They read and write the LSB plane
+    // eight pixels per 64-bit word; the vector<int> versions are wrappers around them.
+    // Extraction reads the triangular arrays in place instead of reconstructing.
+    static BitBuffer extract_LSB_bits(SecretImage& secret_image, int message_length);
+    static std::string decrypt_message_bits(const BitBuffer& bits);
+    static BitBuffer encrypt_message_bits(const std::string& message);
+    static SecretImage embed_LSB_bits(GrayscaleImage& image, const BitBuffer& bits);
+
+    // Embeds the bits directly into the triangular arrays of secret_image. Like
+    // extract_LSB_bits, it only touches the pixels that hold the message.
+    static void embed_LSB_bits(SecretImage& secret_image, const BitBuffer& bits);
 };
 
 #endif // CRYPTO_H
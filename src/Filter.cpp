@@ -1,122 +1,426 @@
 #include "Filter.h"
+#include "BufferPool.h"
+#include "FilterKernels.h"
+#include "KernelCache.h"
+#include "TileExecutor.h"
+#include "Trace.h"
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <iostream>
 #include <vector>
 #include <numeric>
 #include <math.h>
 #include <ostream>
+#include <utility>
 
-// Mean Filter
-void Filter::apply_mean_filter(GrayscaleImage& image, int kernelSize) {
-    // 1. Copy the original image for reference.
-    GrayscaleImage originalImage = GrayscaleImage(image);
+// Blank images the size of the given planes, for the filters to write into.
+static std::vector<GrayscaleImage> blank_planes(GrayscaleImage* const* planes, int count) {
+    std::vector<GrayscaleImage> result;
+    result.reserve(count);
+    for (int p = 0; p < count; p++) {
+        result.emplace_back(planes[p]->get_width(), planes[p]->get_height());
+    }
+    return result;
+}
+
+static std::vector<GrayscaleImage*> pointers_to(std::vector<GrayscaleImage>& images) {
+    std::vector<GrayscaleImage*> result;
+    for (size_t p = 0; p < images.size(); p++) {
+        result.push_back(&images[p]);
+    }
+    return result;
+}
+
+static std::vector<GrayscaleImage*> pointers_to(ColorImage& image) {
+    std::vector<GrayscaleImage*> result;
+    for (int c = 0; c < image.get_channels(); c++) {
+        result.push_back(&image.plane(c));
+    }
+    return result;
+}
+
+// Mean-filters rows [band.begin, band.end) of source into destination, reading
+// the rows and columns past the edges as border says.
+static void mean_rows(const GrayscaleImage& source, GrayscaleImage& destination,
+                      int kernelSize, BorderMode border, const RowBand& band) {
+    int width = source.get_width();
+    int height = source.get_height();
     int countOfRows = (kernelSize - 1) / 2;
+    int divisor = kernelSize * kernelSize;
 
-    // 2. For each pixel, calculate the mean value of its neighbors using a kernel.
-    // 3. Update each pixel with the computed mean.
-    for (int i = 0; i < originalImage.get_height(); i++) {
-        for(int j = 0; j < originalImage.get_width(); j++) {
-            int sum = 0;
-            for(int r = i-countOfRows; r <= i+countOfRows; r++) {
-                for(int c = j-countOfRows; c <= j+countOfRows; c++) {
-                    if (r<0 || r>=originalImage.get_height() || c<0 || c>=originalImage.get_width()) {
-                        sum += 0;
-                    }else {
-                        sum += originalImage.get_pixel(r,c);
-                    }
-                }
-            }
-            int mean = sum / (kernelSize*kernelSize);
-            image.set_pixel(i, j, mean);
+    // 1. Keep a running sum of each column over the rows [i - countOfRows, i + countOfRows].
+    //    Rows past the edges are mapped to the image row the border reads there;
+    //    with zero borders they map to nothing and are simply never added.
+    //    The sums are stored with countOfRows extra columns on both sides, which
+    //    lets the horizontal window slide without any bounds checks.
+    PooledBuffer<int> columnSums(width + 2 * countOfRows, true);
+    int* sums = columnSums.data() + countOfRows;
+    for (int r = band.begin - countOfRows; r <= band.begin + countOfRows; r++) {
+        int mapped = border_index(r, height, border);
+        if (mapped >= 0) {
+            FilterKernels::add_row(sums, source.row(mapped), width);
+        }
+    }
+
+    for (int i = band.begin; i < band.end; i++) {
+        // 2. Fill the side columns for this border, then average each window of
+        //    kernelSize column sums.
+        FilterKernels::pad_sums(columnSums.data(), width, countOfRows, border);
+        FilterKernels::mean_row(columnSums.data(), width, countOfRows, divisor, destination.row(i));
+        if (i + 1 == band.end) {
+            break;
+        }
+
+        // 3. Move the vertical window one row down.
+        int entering = border_index(i + countOfRows + 1, height, border);
+        int leaving = border_index(i - countOfRows, height, border);
+        if (entering >= 0) {
+            FilterKernels::add_row(sums, source.row(entering), width);
+        }
+        if (leaving >= 0) {
+            FilterKernels::subtract_row(sums, source.row(leaving), width);
         }
     }
 }
 
-// Gaussian Smoothing Filter
-void Filter::apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize, double sigma) {
-    GrayscaleImage originalImage = GrayscaleImage(image);
-
-    // 1. Create a Gaussian kernel based on the given sigma value.
-    // 2. Normalize the kernel to ensure it sums to 1.
-    double** kernel = new double*[kernelSize];
-    for (int i = 0; i < kernelSize; i++) {
-        kernel[i] = new double[kernelSize];
-    }
-    int countOfRows =( kernelSize - 1 )/ 2;
-    double sum = 0;
-    for (int i = -countOfRows; i <= countOfRows; i++) {
-        for (int j = -countOfRows; j <= countOfRows; j++) {
-            double coefficient = 1.0 / (2 * M_PI * sigma * sigma);
-            double exponent = -(i * i + j * j) / (2 * sigma * sigma);
-            double kernelValue = coefficient * std::exp(exponent);
-            kernel[i + countOfRows][j + countOfRows] = kernelValue;
-            sum+= kernelValue;
+// Mean-filters count planes of the same size in place.
+static void mean_planes(GrayscaleImage* const* planes, int count, int kernelSize, BorderMode border) {
+    // 1. Read from the original planes and write the means into fresh ones,
+    //    one band of rows of one plane per task.
+    std::vector<GrayscaleImage> results = blank_planes(planes, count);
+    TileExecutor::for_each_plane_band(count, planes[0]->get_height(), (kernelSize - 1) / 2,
+                                      [&](int p, const RowBand& band) {
+        mean_rows(*planes[p], results[p], kernelSize, border, band);
+    });
+
+    // 2. Replace the planes with the filtered results.
+    for (int p = 0; p < count; p++) {
+        *planes[p] = std::move(results[p]);
+    }
+}
+
+// Mean Filter
+void Filter::apply_mean_filter(GrayscaleImage& image, int kernelSize, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height();
+    ScopedTimer timer("filter.mean", pixelCount, 2 * pixelCount);
+    GrayscaleImage* planes[] = { &image };
+    mean_planes(planes, 1, kernelSize, border);
+}
+
+void Filter::apply_mean_filter(ColorImage& image, int kernelSize, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height() * image.get_channels();
+    ScopedTimer timer("filter.mean", pixelCount, 2 * pixelCount);
+    std::vector<GrayscaleImage*> planes = pointers_to(image);
+    mean_planes(planes.data(), image.get_channels(), kernelSize, border);
+}
+
+// Gaussian-smooths rows [band.begin, band.end) of source into destination, as a
+// horizontal pass over the rows the band reads followed by a vertical pass. Rows
+// and columns past the edges read as border says.
+static void gaussian_rows(const GrayscaleImage& source, GrayscaleImage& destination,
+                          const GaussianKernel& kernel, BorderMode border, const RowBand& band) {
+    int width = source.get_width();
+    int height = source.get_height();
+    int countOfRows = kernel.radius;
+
+    // 1. Horizontal pass over the virtual rows [begin - countOfRows, end + countOfRows),
+    //    each taken from the image row the border maps it to. Rows that map to
+    //    nothing (zero borders) are left out.
+    int firstRow = band.begin - countOfRows;
+    int rowCount = band.end - band.begin + 2 * countOfRows;
+    PooledBuffer<double> horizontal((size_t) rowCount * width);
+    PooledBuffer<int> mappedRows(rowCount);
+    PooledBuffer<uint8_t> padded(width + 2 * countOfRows);
+    for (int v = 0; v < rowCount; v++) {
+        mappedRows[v] = border_index(firstRow + v, height, border);
+        if (mappedRows[v] >= 0) {
+            FilterKernels::gaussian_horizontal(source.row(mappedRows[v]), width, kernel, padded.data(),
+                                               &horizontal[(size_t) v * width], border);
         }
+    }
 
+    // 2. Vertical pass over the horizontal sums, one output row at a time.
+    std::vector<const double*> horizontalRows(kernel.size);
+    std::vector<const uint8_t*> sourceRows(kernel.size);
+    PooledBuffer<double> column(width);
+    for (int i = band.begin; i < band.end; i++) {
+        for (int a = 0; a < kernel.size; a++) {
+            int v = i + a - countOfRows - firstRow;
+            bool inside = mappedRows[v] >= 0;
+            horizontalRows[a] = inside ? &horizontal[(size_t) v * width] : nullptr;
+            sourceRows[a] = inside ? source.row(mappedRows[v]) : nullptr;
+        }
+        FilterKernels::gaussian_vertical(horizontalRows.data(), sourceRows.data(), width, kernel,
+                                         column.data(), destination.row(i), border);
     }
-    for (int i = 0; i < kernelSize; i++) {
-        for (int j = 0; j < kernelSize; j++) {
-            kernel[i][j] /= sum;
+}
+
+// Fixed-point counterpart of gaussian_rows: Q6 horizontal results in ints, then
+// a vertical pass that reads a row of zeros wherever the image reads as zeros.
+static void gaussian_rows_fixed(const GrayscaleImage& source, GrayscaleImage& destination,
+                                const GaussianKernel& kernel, BorderMode border, const RowBand& band) {
+    int width = source.get_width();
+    int height = source.get_height();
+    int countOfRows = kernel.radius;
+
+    // 1. Horizontal pass over the virtual rows [begin - countOfRows, end + countOfRows).
+    int firstRow = band.begin - countOfRows;
+    int rowCount = band.end - band.begin + 2 * countOfRows;
+    PooledBuffer<int> horizontal((size_t) rowCount * width);
+    PooledBuffer<int> zeroRow(width, true);
+    std::vector<const int*> virtualRows(rowCount);
+    PooledBuffer<uint8_t> padded(width + 2 * countOfRows);
+    for (int v = 0; v < rowCount; v++) {
+        int mapped = border_index(firstRow + v, height, border);
+        virtualRows[v] = zeroRow.data();
+        if (mapped >= 0) {
+            int* out = &horizontal[(size_t) v * width];
+            FilterKernels::gaussian_horizontal_fixed(source.row(mapped), width, kernel, padded.data(), out, border);
+            virtualRows[v] = out;
         }
     }
 
-    for (int i = 0; i < originalImage.get_height(); i++) {
-        for(int j = 0; j < originalImage.get_width(); j++) {
-            double kernelSum = 0;
-            int startingRow = i - countOfRows;
-            int endingRow = i + countOfRows;
-            int startingCol = j - countOfRows;
-            int endingCol = j + countOfRows;
-
-            // 3. For each pixel, compute the weighted sum using the kernel.
-            for(int r = startingRow; r <= endingRow; r++) {
-                for(int c = startingCol; c <= endingCol; c++) {
-                    if (r >= 0 && r < originalImage.get_height() &&
-                        c >= 0 && c < originalImage.get_width()) {
-                        kernelSum += kernel[r + countOfRows-i][c + countOfRows-j] * originalImage.get_pixel(r, c);
-                        } else {
-                            kernelSum += 0;
-                        }
-                }
-            }
-            int gaussian = (int) kernelSum ;
-            // 4. Update the pixel values with the smoothed results.
-            image.set_pixel(i, j, gaussian);
+    // 2. Vertical pass; output row i reads virtual rows [i - countOfRows, i + countOfRows].
+    for (int i = band.begin; i < band.end; i++) {
+        FilterKernels::gaussian_vertical_fixed(&virtualRows[i - band.begin], width, kernel, destination.row(i));
+    }
+}
+
+static std::atomic<int> precisionSetting(PRECISION_EXACT);
+
+// Whether the fixed-point passes may run for this kernel under the current setting.
+static bool use_fixed_point(const GaussianKernel& kernel) {
+    return precisionSetting.load() == PRECISION_FIXED_POINT && kernel.fixedPointError < 1.0;
+}
+
+// Gaussian-smooths each source plane into its destination with whichever
+// arithmetic applies.
+static void blur(const GrayscaleImage* const* sources, GrayscaleImage* const* destinations, int count,
+                 const GaussianKernel& kernel, BorderMode border) {
+    bool fixed = use_fixed_point(kernel);
+    TileExecutor::for_each_plane_band(count, sources[0]->get_height(), kernel.radius,
+                                      [&](int p, const RowBand& band) {
+        if (fixed) {
+            gaussian_rows_fixed(*sources[p], *destinations[p], kernel, border, band);
+        } else {
+            gaussian_rows(*sources[p], *destinations[p], kernel, border, band);
         }
+    });
+}
+
+// Gaussian-smooths count planes of the same size in place.
+static void gaussian_planes(GrayscaleImage* const* planes, int count, int kernelSize, double sigma,
+                            BorderMode border) {
+    // 1. Fetch the normalized Gaussian kernel for this size and sigma from the cache.
+    std::shared_ptr<const GaussianKernel> kernel = KernelCache::gaussian(kernelSize, sigma);
+
+    // 2. Smooth into fresh planes band by band, then replace the originals with them.
+    std::vector<GrayscaleImage> results = blank_planes(planes, count);
+    blur(planes, pointers_to(results).data(), count, *kernel, border);
+    for (int p = 0; p < count; p++) {
+        *planes[p] = std::move(results[p]);
     }
+}
 
+// Gaussian Smoothing Filter
+void Filter::apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize, double sigma, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height();
+    ScopedTimer timer("filter.gaussian", pixelCount, 2 * pixelCount);
+    GrayscaleImage* planes[] = { &image };
+    gaussian_planes(planes, 1, kernelSize, sigma, border);
+}
 
-    for (int i = 0; i < kernelSize; i++) {
-        delete[] kernel[i];
+void Filter::apply_gaussian_smoothing(ColorImage& image, int kernelSize, double sigma, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
     }
-    delete[] kernel;
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height() * image.get_channels();
+    ScopedTimer timer("filter.gaussian", pixelCount, 2 * pixelCount);
+    std::vector<GrayscaleImage*> planes = pointers_to(image);
+    gaussian_planes(planes.data(), image.get_channels(), kernelSize, sigma, border);
+}
+
+// Unsharp-masks count planes of the same size in place; pixelCount covers all of them.
+static void unsharp_planes(GrayscaleImage* const* planes, int count, int kernelSize, double amount,
+                           BorderMode border, uint64_t pixelCount) {
+    // 1. Blur the planes using Gaussian smoothing, use the default sigma given in the header.
+    //    The blur goes to planes of its own, so the originals need no copy.
+    std::shared_ptr<const GaussianKernel> kernel = KernelCache::gaussian(kernelSize, 1.0);
+    std::vector<GrayscaleImage> blurred = blank_planes(planes, count);
+    {
+        ScopedTimer stage("filter.unsharp.blur", pixelCount, 2 * pixelCount);
+        blur(planes, pointers_to(blurred).data(), count, *kernel, border);
+    }
+
+    // 2. For each pixel, apply the unsharp mask formula: original + amount * (original - blurred).
+    //    This only starts once every band is blurred, since the blur reads across bands.
+    bool fixed = precisionSetting.load() == PRECISION_FIXED_POINT && std::fabs(amount) <= FilterKernels::MAX_FIXED_UNSHARP_AMOUNT;
+    int fixedAmount = (int) std::floor(amount * FilterKernels::UNSHARP_AMOUNT_ONE + 0.5);
+    ScopedTimer stage("filter.unsharp.mask", pixelCount, 3 * pixelCount);
+    TileExecutor::for_each_plane_band(count, planes[0]->get_height(), 0, [&](int p, const RowBand& band) {
+        GrayscaleImage& image = *planes[p];
+        for (int i = band.begin; i < band.end; i++) {
+            if (fixed) {
+                FilterKernels::unsharp_row_fixed(image.row(i), blurred[p].row(i), image.get_width(), fixedAmount, image.row(i));
+            } else {
+                FilterKernels::unsharp_row(image.row(i), blurred[p].row(i), image.get_width(), amount, image.row(i));
+            }
+        }
+    });
 }
 
 // Unsharp Masking Filter
-void Filter::apply_unsharp_mask(GrayscaleImage& image, int kernelSize, double amount) {
-    GrayscaleImage originalImage = GrayscaleImage(image);
+void Filter::apply_unsharp_mask(GrayscaleImage& image, int kernelSize, double amount, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height();
+    ScopedTimer timer("filter.unsharp", pixelCount, 3 * pixelCount);
+    GrayscaleImage* planes[] = { &image };
+    unsharp_planes(planes, 1, kernelSize, amount, border, pixelCount);
+}
 
-    // 1. Blur the image using Gaussian smoothing, use the default sigma given in the header.
-    apply_gaussian_smoothing(image,kernelSize,1.0);
+void Filter::apply_unsharp_mask(ColorImage& image, int kernelSize, double amount, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height() * image.get_channels();
+    ScopedTimer timer("filter.unsharp", pixelCount, 3 * pixelCount);
+    std::vector<GrayscaleImage*> planes = pointers_to(image);
+    unsharp_planes(planes.data(), image.get_channels(), kernelSize, amount, border, pixelCount);
+}
 
-    // 2. For each pixel, apply the unsharp mask formula: original + amount * (original - blurred).
-    for (int i = 0; i < image.get_height(); i++) {
-        for (int j = 0; j < image.get_width(); j++) {
-            int originalIndexValue = originalImage.get_pixel(i, j);
-            int blurredIndexValue = image.get_pixel(i, j);
-            int newIndexValue = (int) (originalIndexValue + amount * (originalIndexValue-blurredIndexValue));
-
-            // 3. Clip values to ensure they are within a valid range [0-255].
-            if(newIndexValue > 255) {
-                newIndexValue = 255;
-            }else if(newIndexValue < 0) {
-                newIndexValue = 0;
+// Convolves rows [band.begin, band.end) of source into destination. Each row the
+// band reads, including rows beyond the image edge, is padded once according to
+// border, so the tap loops never check bounds.
+static void convolve_rows(const GrayscaleImage& source, GrayscaleImage& destination,
+                          const ConvolutionKernel& kernel, BorderMode border, const RowBand& band) {
+    int width = source.get_width();
+    int radiusX = kernel.get_width() / 2;
+    int radiusY = kernel.get_height() / 2;
+    int firstRow = band.begin - radiusY;
+    int rowCount = band.end - band.begin + 2 * radiusY;
+    size_t paddedWidth = (size_t) width + 2 * radiusX;
+
+    // 1. Padded copies of the rows band.begin - radiusY ... band.end + radiusY - 1.
+    PooledBuffer<uint8_t> padded((size_t) rowCount * paddedWidth);
+    for (int v = 0; v < rowCount; v++) {
+        int r = border_index(firstRow + v, source.get_height(), border);
+        if (r < 0) {
+            std::fill(&padded[(size_t) v * paddedWidth], &padded[(size_t) v * paddedWidth] + paddedWidth, 0);
+        } else {
+            FilterKernels::pad_row(source.row(r), width, radiusX, border, &padded[(size_t) v * paddedWidth]);
+        }
+    }
+
+    // 2. Separable kernels: the row pass over every padded row, then the column
+    //    pass per output row, in integers when the factors allow it. An integral
+    //    kernel without integer factors stays on the 2D integer taps, so that every
+    //    integral kernel divides exactly.
+    if (kernel.is_separable() && (kernel.is_integer_separable() || !kernel.is_integral())) {
+        bool integer = kernel.is_integer_separable();
+        PooledBuffer<int> integerRows(integer ? (size_t) rowCount * width : 0);
+        PooledBuffer<double> realRows(integer ? 0 : (size_t) rowCount * width);
+        for (int v = 0; v < rowCount; v++) {
+            if (integer) {
+                FilterKernels::convolve_horizontal(&padded[(size_t) v * paddedWidth], width, kernel,
+                                                   &integerRows[(size_t) v * width]);
+            } else {
+                FilterKernels::convolve_horizontal(&padded[(size_t) v * paddedWidth], width, kernel,
+                                                   &realRows[(size_t) v * width]);
+            }
+        }
+        std::vector<const int*> integerTaps(kernel.get_height());
+        std::vector<const double*> realTaps(kernel.get_height());
+        std::vector<const uint8_t*> paddedTaps(kernel.get_height());
+        for (int i = band.begin; i < band.end; i++) {
+            for (int a = 0; a < kernel.get_height(); a++) {
+                size_t offset = (size_t) (i - band.begin + a) * width;
+                if (integer) {
+                    integerTaps[a] = &integerRows[offset];
+                } else {
+                    realTaps[a] = &realRows[offset];
+                    paddedTaps[a] = &padded[(size_t) (i - band.begin + a) * paddedWidth];
+                }
+            }
+            if (integer) {
+                FilterKernels::convolve_vertical(integerTaps.data(), width, kernel, destination.row(i));
+            } else {
+                FilterKernels::convolve_vertical(realTaps.data(), paddedTaps.data(), width, kernel,
+                                                 destination.row(i));
             }
-            image.set_pixel(i, j, newIndexValue);
         }
+        return;
+    }
+
+    // 3. Everything else: the 2D taps straight over the padded rows.
+    std::vector<const uint8_t*> taps(kernel.get_height());
+    for (int i = band.begin; i < band.end; i++) {
+        for (int a = 0; a < kernel.get_height(); a++) {
+            taps[a] = &padded[(size_t) (i - band.begin + a) * paddedWidth];
+        }
+        FilterKernels::convolve_row(taps.data(), width, kernel, destination.row(i));
+    }
+}
+
+// Convolves count planes of the same size in place.
+static void convolve_planes(GrayscaleImage* const* planes, int count, const ConvolutionKernel& kernel,
+                            BorderMode border) {
+    std::vector<GrayscaleImage> results = blank_planes(planes, count);
+    TileExecutor::for_each_plane_band(count, planes[0]->get_height(), kernel.get_height() / 2,
+                                      [&](int p, const RowBand& band) {
+        convolve_rows(*planes[p], results[p], kernel, border, band);
+    });
+    for (int p = 0; p < count; p++) {
+        *planes[p] = std::move(results[p]);
     }
+}
+
+// Convolution with an arbitrary kernel
+void Filter::convolve(GrayscaleImage& image, const ConvolutionKernel& kernel, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height();
+    ScopedTimer timer("filter.convolve", pixelCount, 2 * pixelCount);
+    GrayscaleImage* planes[] = { &image };
+    convolve_planes(planes, 1, kernel, border);
+}
 
+void Filter::convolve(ColorImage& image, const ConvolutionKernel& kernel, BorderMode border) {
+    if (image.get_width() == 0 || image.get_height() == 0) {
+        return;
+    }
+    uint64_t pixelCount = (uint64_t) image.get_width() * image.get_height() * image.get_channels();
+    ScopedTimer timer("filter.convolve", pixelCount, 2 * pixelCount);
+    std::vector<GrayscaleImage*> planes = pointers_to(image);
+    convolve_planes(planes.data(), image.get_channels(), kernel, border);
+}
 
+// Thread count used by every filter
+void Filter::set_thread_count(int threads) {
+    TileExecutor::set_thread_count(threads);
+}
+
+int Filter::get_thread_count() {
+    return TileExecutor::get_thread_count();
+}
+
+// Arithmetic used by the Gaussian and unsharp filters
+void Filter::set_precision(FilterPrecision precision) {
+    precisionSetting = precision;
+}
 
+FilterPrecision Filter::get_precision() {
+    return (FilterPrecision) precisionSetting.load();
 }
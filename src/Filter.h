@@ -1,18 +1,62 @@
 #ifndef FILTER_H
 #define FILTER_H
 
+#include "BorderMode.h"
+#include "ColorImage.h"
+#include "ConvolutionKernel.h"
 #include "GrayscaleImage.h"
 
+// Arithmetic used by the Gaussian and unsharp filters.
+enum FilterPrecision {
+    PRECISION_EXACT,        // Doubles; bit-identical to the original 2D filters
+    PRECISION_FIXED_POINT   // 16-bit weights and 32-bit integer sums; see set_precision
+};
+
 class Filter {
 public:
+    // The filters read pixels past the image edges as border says; the default
+    // treats them as zero. The ColorImage overloads filter every channel, alpha
+    // included, exactly as the grayscale filter would filter that plane alone;
+    // the bands of all channels share one pass over the thread pool.
+
     // Apply the Mean Filter
-    static void apply_mean_filter(GrayscaleImage& image, int kernelSize = 3);
+    static void apply_mean_filter(GrayscaleImage& image, int kernelSize = 3, BorderMode border = BORDER_ZERO);
+    static void apply_mean_filter(ColorImage& image, int kernelSize = 3, BorderMode border = BORDER_ZERO);
 
     // Apply Gaussian Smoothing Filter
-    static void apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize = 3, double sigma = 1.0);
+    static void apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize = 3, double sigma = 1.0,
+                                         BorderMode border = BORDER_ZERO);
+    static void apply_gaussian_smoothing(ColorImage& image, int kernelSize = 3, double sigma = 1.0,
+                                         BorderMode border = BORDER_ZERO);
 
     // Apply Unsharp Masking Filter
-    static void apply_unsharp_mask(GrayscaleImage& image, int kernelSize = 3, double amount = 1.5);
+    static void apply_unsharp_mask(GrayscaleImage& image, int kernelSize = 3, double amount = 1.5,
+                                   BorderMode border = BORDER_ZERO);
+    static void apply_unsharp_mask(ColorImage& image, int kernelSize = 3, double amount = 1.5,
+                                   BorderMode border = BORDER_ZERO);
+
+    // Apply an arbitrary kernel (Sobel, Laplacian, box, custom weights...). Integral
+    // kernels are summed in integers and divided exactly, which can come out one
+    // above the double sum of the divided weights (a 5x5 box over a constant image
+    // sums to 0.99999... times the pixel in doubles). Other kernels give the direct
+    // double sum, separable ones included.
+    static void convolve(GrayscaleImage& image, const ConvolutionKernel& kernel, BorderMode border = BORDER_ZERO);
+    static void convolve(ColorImage& image, const ConvolutionKernel& kernel, BorderMode border = BORDER_ZERO);
+
+    // Number of threads the filters split their rows across. Defaults to the
+    // CLEARVISION_THREADS environment variable, else the hardware concurrency.
+    // The output is identical for any thread count.
+    static void set_thread_count(int threads);
+    static int get_thread_count();
+
+    // Arithmetic for the Gaussian and unsharp filters, PRECISION_EXACT by default.
+    // With PRECISION_FIXED_POINT a Gaussian pixel is at most one gray level away
+    // from the exact result, and an unsharp pixel at most ceil(|amount|) + 1 levels
+    // (the blur's level times amount, plus one for the quantized amount). Kernels
+    // whose quantization could break that bound, and amounts beyond +-1000, keep
+    // using doubles.
+    static void set_precision(FilterPrecision precision);
+    static FilterPrecision get_precision();
 };
 
 #endif // FILTER_H
@@ -0,0 +1,381 @@
+#include "FilterKernels.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// Distance from an integer below which a separable Gaussian sum is re-evaluated
+// with the 2D kernel. The two summation orders differ by many orders of magnitude
+// less than this, so any sum further away truncates to the same integer either way.
+static const double TRUNCATION_MARGIN = 1e-6;
+
+// Weighted 2D Gaussian sum around column j, accumulated in the original tap order.
+static double gaussian_reference(const uint8_t* const* source, int width, const GaussianKernel& kernel,
+                                 BorderMode border, int j) {
+    int countOfRows = kernel.radius;
+    double kernelSum = 0;
+    for (int a = 0; a < kernel.size; a++) {
+        if (source[a] == nullptr) {
+            continue;
+        }
+        const double* weights = &kernel.weights2D[(size_t) a * kernel.size];
+        for (int c = j - countOfRows; c <= j + countOfRows; c++) {
+            int column = border_index(c, width, border);
+            if (column >= 0) {
+                kernelSum += weights[c + countOfRows - j] * source[a][column];
+            }
+        }
+    }
+    return kernelSum;
+}
+
+void FilterKernels::add_row(int* sums, const uint8_t* row, int width) {
+    for (int j = 0; j < width; j++) {
+        sums[j] += row[j];
+    }
+}
+
+void FilterKernels::subtract_row(int* sums, const uint8_t* row, int width) {
+    for (int j = 0; j < width; j++) {
+        sums[j] -= row[j];
+    }
+}
+
+void FilterKernels::mean_row(const int* paddedSums, int width, int radius, int divisor, uint8_t* out) {
+    // Slide the window along the row; each step adds the entering column and
+    // drops the leaving one.
+    int sum = 0;
+    for (int c = 0; c < 2 * radius; c++) {
+        sum += paddedSums[c];
+    }
+    for (int j = 0; j < width; j++) {
+        sum += paddedSums[j + 2 * radius];
+        out[j] = static_cast<uint8_t>(sum / divisor);
+        sum -= paddedSums[j];
+    }
+}
+
+void FilterKernels::pad_sums(int* paddedSums, int width, int radius, BorderMode border) {
+    int* sums = paddedSums + radius;
+    for (int j = -radius; j < 0; j++) {
+        int source = border_index(j, width, border);
+        sums[j] = source < 0 ? 0 : sums[source];
+    }
+    for (int j = width; j < width + radius; j++) {
+        int source = border_index(j, width, border);
+        sums[j] = source < 0 ? 0 : sums[source];
+    }
+}
+
+void FilterKernels::gaussian_horizontal(const uint8_t* row, int width, const GaussianKernel& kernel,
+                                        uint8_t* padded, double* out, BorderMode border) {
+    pad_row(row, width, kernel.radius, border, padded);
+    std::fill(out, out + width, 0.0);
+    for (int b = 0; b < kernel.size; b++) {
+        const uint8_t* in = padded + b;
+        double weight = kernel.weights[b];
+        for (int c = 0; c < width; c++) {
+            out[c] += weight * in[c];
+        }
+    }
+}
+
+void FilterKernels::gaussian_vertical(const double* const* horizontal, const uint8_t* const* source,
+                                      int width, const GaussianKernel& kernel, double* column, uint8_t* out,
+                                      BorderMode border) {
+    // 1. Weighted sum of the horizontal rows; rows that read as zeros add nothing.
+    std::fill(column, column + width, 0.0);
+    for (int a = 0; a < kernel.size; a++) {
+        if (horizontal[a] == nullptr) {
+            continue;
+        }
+        const double* in = horizontal[a];
+        double weight = kernel.weights[a];
+        for (int c = 0; c < width; c++) {
+            column[c] += weight * in[c];
+        }
+    }
+
+    // 2. Truncate like the 2D filter does. Sums that land next to an integer are
+    //    recomputed in the original order so the result stays bit-identical.
+    for (int c = 0; c < width; c++) {
+        double kernelSum = column[c];
+        if (std::fabs(kernelSum - std::floor(kernelSum + 0.5)) < TRUNCATION_MARGIN) {
+            kernelSum = gaussian_reference(source, width, kernel, border, c);
+        }
+        out[c] = static_cast<uint8_t>((int) kernelSum);
+    }
+}
+
+void FilterKernels::unsharp_row(const uint8_t* original, const uint8_t* blurred, int width,
+                                double amount, uint8_t* out) {
+    for (int j = 0; j < width; j++) {
+        int originalIndexValue = original[j];
+        int blurredIndexValue = blurred[j];
+        int newIndexValue = (int) (originalIndexValue + amount * (originalIndexValue-blurredIndexValue));
+
+        // Clip values to ensure they are within a valid range [0-255].
+        if(newIndexValue > 255) {
+            newIndexValue = 255;
+        }else if(newIndexValue < 0) {
+            newIndexValue = 0;
+        }
+        out[j] = static_cast<uint8_t>(newIndexValue);
+    }
+}
+
+void FilterKernels::unsharp_row_fixed(const uint8_t* original, const uint8_t* blurred, int width,
+                                      int fixedAmount, uint8_t* out) {
+    // Division rounds toward zero, which matches the (int) truncation of unsharp_row.
+    for (int j = 0; j < width; j++) {
+        int value = (original[j] * UNSHARP_AMOUNT_ONE + fixedAmount * (original[j] - blurred[j])) / UNSHARP_AMOUNT_ONE;
+        out[j] = static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+    }
+}
+
+void FilterKernels::pad_row(const uint8_t* row, int width, int radius, BorderMode border, uint8_t* padded) {
+    std::memcpy(padded + radius, row, width);
+    for (int j = -radius; j < 0; j++) {
+        int source = border_index(j, width, border);
+        padded[j + radius] = source < 0 ? 0 : row[source];
+    }
+    for (int j = width; j < width + radius; j++) {
+        int source = border_index(j, width, border);
+        padded[j + radius] = source < 0 ? 0 : row[source];
+    }
+}
+
+// Pixels accumulated at once by the convolution loops. The block of sums stays in
+// registers or L1 while every tap is added, and the loop over it vectorizes.
+static const int CONVOLUTION_BLOCK = 64;
+
+// Divides, truncates toward zero and clamps a finished tap sum.
+static inline uint8_t finish_sum(int sum, int divisor) {
+    int value = divisor == 1 ? sum : sum / divisor;
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+}
+
+static inline uint8_t finish_sum(double sum, double divisor) {
+    double value = sum / divisor;
+    return static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : (int) value));
+}
+
+// 2D taps over one output row. KW and KH fix the kernel size at compile time so
+// the tap loops unroll; 0 means the size is only known at runtime.
+template <int KW, int KH, typename Sum>
+static void direct_row(const uint8_t* const* rows, int width, int runtimeWidth, int runtimeHeight,
+                       const Sum* weights, Sum divisor, uint8_t* out) {
+    const int kernelWidth = KW > 0 ? KW : runtimeWidth;
+    const int kernelHeight = KH > 0 ? KH : runtimeHeight;
+    Sum sums[CONVOLUTION_BLOCK];
+    for (int x0 = 0; x0 < width; x0 += CONVOLUTION_BLOCK) {
+        int count = std::min(CONVOLUTION_BLOCK, width - x0);
+        for (int i = 0; i < count; i++) {
+            sums[i] = 0;
+        }
+        for (int a = 0; a < kernelHeight; a++) {
+            const uint8_t* row = rows[a] + x0;
+            for (int b = 0; b < kernelWidth; b++) {
+                Sum weight = weights[a * kernelWidth + b];
+                if (weight == 0) {
+                    continue;
+                }
+                for (int i = 0; i < count; i++) {
+                    sums[i] += weight * row[i + b];
+                }
+            }
+        }
+        for (int i = 0; i < count; i++) {
+            out[x0 + i] = finish_sum(sums[i], divisor);
+        }
+    }
+}
+
+template <typename Sum>
+static void direct_row_dispatch(const uint8_t* const* rows, int width, int kernelWidth, int kernelHeight,
+                                const Sum* weights, Sum divisor, uint8_t* out) {
+    int size = kernelWidth == kernelHeight ? kernelWidth : 0;
+    switch (size) {
+        case 3:
+            direct_row<3, 3>(rows, width, 3, 3, weights, divisor, out);
+            break;
+        case 5:
+            direct_row<5, 5>(rows, width, 5, 5, weights, divisor, out);
+            break;
+        case 7:
+            direct_row<7, 7>(rows, width, 7, 7, weights, divisor, out);
+            break;
+        default:
+            direct_row<0, 0>(rows, width, kernelWidth, kernelHeight, weights, divisor, out);
+            break;
+    }
+}
+
+void FilterKernels::convolve_row(const uint8_t* const* rows, int width, const ConvolutionKernel& kernel, uint8_t* out) {
+    if (kernel.is_integral()) {
+        direct_row_dispatch<int>(rows, width, kernel.get_width(), kernel.get_height(),
+                                 kernel.get_integer_weights().data(), kernel.get_integer_divisor(), out);
+    } else {
+        direct_row_dispatch<double>(rows, width, kernel.get_width(), kernel.get_height(),
+                                    kernel.get_weights().data(), 1.0, out);
+    }
+}
+
+// sums[i] += weight * row[i] for i < count. Full blocks get a constant trip count,
+// so the compiler vectorizes them without runtime checks even at -O2.
+template <typename Sum, typename Pixel>
+static inline void multiply_add(Sum* sums, const Pixel* row, Sum weight, int count) {
+    if (count == CONVOLUTION_BLOCK) {
+        for (int i = 0; i < CONVOLUTION_BLOCK; i++) {
+            sums[i] += weight * row[i];
+        }
+    } else {
+        for (int i = 0; i < count; i++) {
+            sums[i] += weight * row[i];
+        }
+    }
+}
+
+// Row-vector taps over one padded row, K taps fixed at compile time (0 = runtime).
+template <int K, typename Sum>
+static void horizontal_taps(const uint8_t* padded, int width, int runtimeTaps, const Sum* weights, Sum* out) {
+    const int taps = K > 0 ? K : runtimeTaps;
+    Sum sums[CONVOLUTION_BLOCK];
+    for (int x0 = 0; x0 < width; x0 += CONVOLUTION_BLOCK) {
+        int count = std::min(CONVOLUTION_BLOCK, width - x0);
+        const uint8_t* row = padded + x0;
+        for (int i = 0; i < count; i++) {
+            sums[i] = 0;
+        }
+        for (int b = 0; b < taps; b++) {
+            Sum weight = weights[b];
+            if (weight != 0) {
+                multiply_add(sums, row + b, weight, count);
+            }
+        }
+        std::copy(sums, sums + count, out + x0);
+    }
+}
+
+// Column-vector taps over K rows of horizontal results; finish(sum, x) turns the
+// sum for column x into the output pixel.
+template <int K, typename Sum, typename Finish>
+static void vertical_taps(const Sum* const* rows, int width, int runtimeTaps, const Sum* weights,
+                          const Finish& finish, uint8_t* out) {
+    const int taps = K > 0 ? K : runtimeTaps;
+    Sum sums[CONVOLUTION_BLOCK];
+    for (int x0 = 0; x0 < width; x0 += CONVOLUTION_BLOCK) {
+        int count = std::min(CONVOLUTION_BLOCK, width - x0);
+        for (int i = 0; i < count; i++) {
+            sums[i] = 0;
+        }
+        for (int a = 0; a < taps; a++) {
+            Sum weight = weights[a];
+            if (weight == 0) {
+                continue;
+            }
+            multiply_add(sums, rows[a] + x0, weight, count);
+        }
+        for (int i = 0; i < count; i++) {
+            out[x0 + i] = finish(sums[i], x0 + i);
+        }
+    }
+}
+
+template <typename Sum>
+static void horizontal_dispatch(const uint8_t* padded, int width, int taps, const Sum* weights, Sum* out) {
+    switch (taps) {
+        case 3:
+            horizontal_taps<3>(padded, width, 3, weights, out);
+            break;
+        case 5:
+            horizontal_taps<5>(padded, width, 5, weights, out);
+            break;
+        case 7:
+            horizontal_taps<7>(padded, width, 7, weights, out);
+            break;
+        default:
+            horizontal_taps<0>(padded, width, taps, weights, out);
+            break;
+    }
+}
+
+template <typename Sum, typename Finish>
+static void vertical_dispatch(const Sum* const* rows, int width, int taps, const Sum* weights,
+                              const Finish& finish, uint8_t* out) {
+    switch (taps) {
+        case 3:
+            vertical_taps<3>(rows, width, 3, weights, finish, out);
+            break;
+        case 5:
+            vertical_taps<5>(rows, width, 5, weights, finish, out);
+            break;
+        case 7:
+            vertical_taps<7>(rows, width, 7, weights, finish, out);
+            break;
+        default:
+            vertical_taps<0>(rows, width, taps, weights, finish, out);
+            break;
+    }
+}
+
+void FilterKernels::gaussian_horizontal_fixed(const uint8_t* row, int width, const GaussianKernel& kernel,
+                                              uint8_t* padded, int* out, BorderMode border) {
+    // Q14 sums, rounded down to Q6 so the vertical pass stays within 32 bits.
+    const int shift = GAUSSIAN_WEIGHT_BITS - GAUSSIAN_HORIZONTAL_BITS;
+    const int half = 1 << (shift - 1);
+    pad_row(row, width, kernel.radius, border, padded);
+    horizontal_dispatch(padded, width, kernel.size, kernel.fixedWeights.data(), out);
+    for (int c = 0; c < width; c++) {
+        out[c] = (out[c] + half) >> shift;
+    }
+}
+
+void FilterKernels::gaussian_vertical_fixed(const int* const* horizontal, int width, const GaussianKernel& kernel,
+                                            uint8_t* out) {
+    // The sums are non-negative and at most 255 in Q20, so a shift truncates
+    // them and no clamping is needed.
+    const int shift = GAUSSIAN_WEIGHT_BITS + GAUSSIAN_HORIZONTAL_BITS;
+    vertical_dispatch(horizontal, width, kernel.size, kernel.fixedWeights.data(),
+                      [shift](int sum, int) { return static_cast<uint8_t>(sum >> shift); }, out);
+}
+
+void FilterKernels::convolve_horizontal(const uint8_t* padded, int width, const ConvolutionKernel& kernel, int* out) {
+    horizontal_dispatch(padded, width, kernel.get_width(), kernel.get_integer_row().data(), out);
+}
+
+void FilterKernels::convolve_horizontal(const uint8_t* padded, int width, const ConvolutionKernel& kernel, double* out) {
+    horizontal_dispatch(padded, width, kernel.get_width(), kernel.get_row_weights().data(), out);
+}
+
+void FilterKernels::convolve_vertical(const int* const* rows, int width, const ConvolutionKernel& kernel, uint8_t* out) {
+    int divisor = kernel.get_integer_divisor();
+    vertical_dispatch(rows, width, kernel.get_height(), kernel.get_integer_column().data(),
+                      [divisor](int sum, int) { return finish_sum(sum, divisor); }, out);
+}
+
+void FilterKernels::convolve_vertical(const double* const* rows, const uint8_t* const* padded, int width,
+                                      const ConvolutionKernel& kernel, uint8_t* out) {
+    // A separable sum that lands next to an integer may truncate differently from
+    // the 2D sum; redo those pixels with the 2D weights in the direct tap order.
+    // "Next to" also covers the most the factors can be off by, so kernels that
+    // are only separable within the tolerance still match the direct sum.
+    const double* weights = kernel.get_weights().data();
+    int kernelWidth = kernel.get_width();
+    int kernelHeight = kernel.get_height();
+    double margin = TRUNCATION_MARGIN + kernel.get_separable_error();
+    auto finish = [&](double sum, int x) {
+        if (sum >= -1 - margin && sum <= 256 + margin && std::fabs(sum - std::floor(sum + 0.5)) < margin) {
+            sum = 0;
+            for (int a = 0; a < kernelHeight; a++) {
+                for (int b = 0; b < kernelWidth; b++) {
+                    double weight = weights[a * kernelWidth + b];
+                    if (weight != 0) {
+                        sum += weight * padded[a][x + b];
+                    }
+                }
+            }
+        }
+        return finish_sum(sum, 1.0);
+    };
+    vertical_dispatch(rows, width, kernelHeight, kernel.get_column_weights().data(), finish, out);
+}
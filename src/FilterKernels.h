@@ -0,0 +1,86 @@
+#ifndef FILTER_KERNELS_H
+#define FILTER_KERNELS_H
+
+#include <cstdint>
+
+#include "BorderMode.h"
+#include "ConvolutionKernel.h"
+#include "KernelCache.h"
+
+// Row-level building blocks shared by Filter's banded passes and FilterPipeline's
+// streaming stages. Every function works on single rows, so callers decide how
+// rows are buffered and where the results go.
+class FilterKernels {
+public:
+    // Adds / subtracts one row of pixels to / from per-column running sums.
+    static void add_row(int* sums, const uint8_t* row, int width);
+    static void subtract_row(int* sums, const uint8_t* row, int width);
+
+    // Writes the mean of every (2 * radius + 1)-wide window of column sums, divided
+    // by divisor. paddedSums holds radius entries on both sides of the width sums,
+    // zero or filled in by pad_sums.
+    static void mean_row(const int* paddedSums, int width, int radius, int divisor, uint8_t* out);
+
+    // Fills the radius entries on each side of the width column sums in paddedSums
+    // from the columns border maps them to.
+    static void pad_sums(int* paddedSums, int width, int radius, BorderMode border);
+
+    // Horizontal Gaussian pass over one row, extended past its ends according to
+    // border. padded is scratch space of width + 2 * radius bytes.
+    static void gaussian_horizontal(const uint8_t* row, int width, const GaussianKernel& kernel,
+                                    uint8_t* padded, double* out, BorderMode border = BORDER_ZERO);
+
+    // Vertical Gaussian pass producing one output row. horizontal[a] and source[a] are
+    // the horizontal sums and the pixels of the row a - radius rows away from the
+    // output row (after border mapping), or null where that row reads as zeros.
+    // column is scratch space for width doubles. The result matches the 2D filter
+    // with the same border bit for bit.
+    static void gaussian_vertical(const double* const* horizontal, const uint8_t* const* source,
+                                  int width, const GaussianKernel& kernel, double* column, uint8_t* out,
+                                  BorderMode border = BORDER_ZERO);
+
+    // Fixed-point Gaussian passes with the kernel's Q14 weights and int sums. The
+    // horizontal pass writes Q6 results; the vertical pass reads kernel.size rows of
+    // them (a row of zeros where the image reads as zeros) and truncates the Q20 sum.
+    // The output is within one gray level of gaussian_vertical's whenever
+    // kernel.fixedPointError < 1.
+    static void gaussian_horizontal_fixed(const uint8_t* row, int width, const GaussianKernel& kernel,
+                                          uint8_t* padded, int* out, BorderMode border = BORDER_ZERO);
+    static void gaussian_vertical_fixed(const int* const* horizontal, int width, const GaussianKernel& kernel,
+                                        uint8_t* out);
+
+    // out = clamp(original + amount * (original - blurred)), truncated like the 2D filter.
+    static void unsharp_row(const uint8_t* original, const uint8_t* blurred, int width,
+                            double amount, uint8_t* out);
+
+    // unsharp_row with amount given in Q12 (amount * UNSHARP_AMOUNT_ONE, rounded)
+    // and integer arithmetic. |fixedAmount| * 255 must stay below 2^30, which
+    // amounts up to MAX_FIXED_UNSHARP_AMOUNT keep well clear of.
+    static const int UNSHARP_AMOUNT_ONE = 1 << 12;
+    static const int MAX_FIXED_UNSHARP_AMOUNT = 1000;
+    static void unsharp_row_fixed(const uint8_t* original, const uint8_t* blurred, int width,
+                                  int fixedAmount, uint8_t* out);
+
+    // Copies row into padded[radius, radius + width) and fills radius pixels on each
+    // side according to border. Only the 2 * radius edge pixels go through the
+    // border rules; the interior is a plain copy.
+    static void pad_row(const uint8_t* row, int width, int radius, BorderMode border, uint8_t* padded);
+
+    // Direct 2D convolution producing one output row. rows[a] is the padded input
+    // row (width + kernel width - 1 pixels) that kernel row a is applied to.
+    static void convolve_row(const uint8_t* const* rows, int width, const ConvolutionKernel& kernel, uint8_t* out);
+
+    // Separable convolution: the row-vector pass over one padded row, then the
+    // column-vector pass over the kernel-height horizontal results of an output row.
+    // The int versions need an integer-separable kernel and are exact. The double
+    // version also takes the padded rows, and redoes any sum that lands within
+    // truncation distance of an integer with the 2D weights, so it matches
+    // convolve_row bit for bit.
+    static void convolve_horizontal(const uint8_t* padded, int width, const ConvolutionKernel& kernel, int* out);
+    static void convolve_horizontal(const uint8_t* padded, int width, const ConvolutionKernel& kernel, double* out);
+    static void convolve_vertical(const int* const* rows, int width, const ConvolutionKernel& kernel, uint8_t* out);
+    static void convolve_vertical(const double* const* rows, const uint8_t* const* padded, int width,
+                                  const ConvolutionKernel& kernel, uint8_t* out);
+};
+
+#endif // FILTER_KERNELS_H
@@ -0,0 +1,277 @@
+#include "FilterPipeline.h"
+#include "Filter.h"
+#include "FilterKernels.h"
+#include "KernelCache.h"
+#include "PixelOps.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+// Reads the rows of an image in place.
+class ImageRowSource : public RowSource {
+private:
+    const GrayscaleImage& image;
+public:
+    explicit ImageRowSource(const GrayscaleImage& image) : image(image) {}
+    int get_width() const { return image.get_width(); }
+    int get_height() const { return image.get_height(); }
+    const uint8_t* read_row(int i) { return image.row(i); }
+};
+
+// Writes rows into an image.
+class ImageRowSink : public RowSink {
+private:
+    GrayscaleImage& image;
+public:
+    explicit ImageRowSink(GrayscaleImage& image) : image(image) {}
+    void write_row(int i, const uint8_t* row) {
+        std::memmove(image.row(i), row, image.get_width());
+    }
+};
+
+// Fixed number of row buffers; row r lives in slot r % count.
+class RowRing {
+private:
+    std::vector<uint8_t> data;
+    int width, count;
+public:
+    RowRing(int width, int count) : data((size_t) width * count), width(width), count(count) {}
+    uint8_t* slot(int r) { return &data[(size_t) (r % count) * width]; }
+};
+
+// A stage is a row source that pulls its input rows from the stage before it.
+class PipelineStage : public RowSource {
+protected:
+    RowSource& upstream;
+    int width, height;
+    std::vector<uint8_t> output;
+public:
+    explicit PipelineStage(RowSource& upstream)
+        : upstream(upstream), width(upstream.get_width()), height(upstream.get_height()),
+          output(upstream.get_width()) {}
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+};
+
+// Mean filter over a rolling window of kernelSize input rows.
+class MeanStage : public PipelineStage {
+private:
+    int radius, divisor;
+    RowRing window;                 // Input rows [i - radius, i + radius]
+    std::vector<int> columnSums;    // Running column sums with radius zeros on each side
+    int pulled;                     // Input rows read so far
+public:
+    MeanStage(RowSource& upstream, int kernelSize)
+        : PipelineStage(upstream), radius((kernelSize - 1) / 2), divisor(kernelSize * kernelSize),
+          window(width, 2 * radius + 1), columnSums(width + 2 * radius, 0), pulled(0) {}
+
+    const uint8_t* read_row(int i) {
+        // Drop the row leaving the window before its slot is reused, then pull
+        // every row up to i + radius.
+        int* sums = columnSums.data() + radius;
+        if (i - radius - 1 >= 0) {
+            FilterKernels::subtract_row(sums, window.slot(i - radius - 1), width);
+        }
+        for (; pulled < height && pulled <= i + radius; pulled++) {
+            uint8_t* row = window.slot(pulled);
+            std::memcpy(row, upstream.read_row(pulled), width);
+            FilterKernels::add_row(sums, row, width);
+        }
+        FilterKernels::mean_row(columnSums.data(), width, radius, divisor, output.data());
+        return output.data();
+    }
+};
+
+// Gaussian smoothing over a rolling window of input rows and their horizontal sums.
+// Under PRECISION_FIXED_POINT the sums are the Q6 ints of the fixed-point passes,
+// on the same condition Filter uses them.
+class GaussianStage : public PipelineStage {
+protected:
+    std::shared_ptr<const GaussianKernel> kernel;
+    bool fixed;
+    RowRing window;                 // Input rows [i - radius, i + radius]
+    std::vector<double> horizontal; // Horizontal sums, one slot per window row
+    std::vector<int> horizontalFixed;
+    std::vector<int> zeroRow;       // Fixed-point stand-in for rows outside the image
+    std::vector<uint8_t> padded;
+    std::vector<double> column;
+    std::vector<const double*> horizontalRows;
+    std::vector<const int*> fixedRows;
+    std::vector<const uint8_t*> sourceRows;
+    int pulled;
+
+    void blur_row(int i, uint8_t* out) {
+        int size = kernel->size;
+        int radius = kernel->radius;
+        for (; pulled < height && pulled <= i + radius; pulled++) {
+            uint8_t* row = window.slot(pulled);
+            std::memcpy(row, upstream.read_row(pulled), width);
+            size_t slot = (size_t) (pulled % size) * width;
+            if (fixed) {
+                FilterKernels::gaussian_horizontal_fixed(row, width, *kernel, padded.data(), &horizontalFixed[slot]);
+            } else {
+                FilterKernels::gaussian_horizontal(row, width, *kernel, padded.data(), &horizontal[slot]);
+            }
+        }
+        for (int a = 0; a < size; a++) {
+            int r = i + a - radius;
+            bool inside = r >= 0 && r < height;
+            size_t slot = inside ? (size_t) (r % size) * width : 0;
+            if (fixed) {
+                fixedRows[a] = inside ? &horizontalFixed[slot] : zeroRow.data();
+            } else {
+                horizontalRows[a] = inside ? &horizontal[slot] : nullptr;
+                sourceRows[a] = inside ? window.slot(r) : nullptr;
+            }
+        }
+        if (fixed) {
+            FilterKernels::gaussian_vertical_fixed(fixedRows.data(), width, *kernel, out);
+        } else {
+            FilterKernels::gaussian_vertical(horizontalRows.data(), sourceRows.data(), width, *kernel,
+                                             column.data(), out);
+        }
+    }
+
+public:
+    GaussianStage(RowSource& upstream, int kernelSize, double sigma)
+        : PipelineStage(upstream), kernel(KernelCache::gaussian(kernelSize, sigma)),
+          fixed(Filter::get_precision() == PRECISION_FIXED_POINT && kernel->fixedPointError < 1.0),
+          window(width, kernel->size),
+          horizontal(fixed ? 0 : (size_t) kernel->size * width),
+          horizontalFixed(fixed ? (size_t) kernel->size * width : 0), zeroRow(fixed ? width : 0, 0),
+          padded(width + 2 * kernel->radius, 0), column(fixed ? 0 : width),
+          horizontalRows(kernel->size), fixedRows(kernel->size), sourceRows(kernel->size), pulled(0) {}
+
+    const uint8_t* read_row(int i) {
+        blur_row(i, output.data());
+        return output.data();
+    }
+};
+
+// Unsharp mask: blurs like GaussianStage, then combines with the centre input row,
+// in Q12 integers under PRECISION_FIXED_POINT as Filter does.
+class UnsharpStage : public GaussianStage {
+private:
+    double amount;
+    bool fixedMask;
+    int fixedAmount;
+    std::vector<uint8_t> blurred;
+public:
+    UnsharpStage(RowSource& upstream, int kernelSize, double amount)
+        : GaussianStage(upstream, kernelSize, 1.0), amount(amount),
+          fixedMask(Filter::get_precision() == PRECISION_FIXED_POINT &&
+                    std::fabs(amount) <= FilterKernels::MAX_FIXED_UNSHARP_AMOUNT),
+          fixedAmount((int) std::floor(amount * FilterKernels::UNSHARP_AMOUNT_ONE + 0.5)), blurred(width) {}
+
+    const uint8_t* read_row(int i) {
+        blur_row(i, blurred.data());
+        if (fixedMask) {
+            FilterKernels::unsharp_row_fixed(window.slot(i), blurred.data(), width, fixedAmount, output.data());
+        } else {
+            FilterKernels::unsharp_row(window.slot(i), blurred.data(), width, amount, output.data());
+        }
+        return output.data();
+    }
+};
+
+// Saturating addition or subtraction of an operand image, row by row.
+class ArithmeticStage : public PipelineStage {
+private:
+    const GrayscaleImage& operand;
+    bool subtract;
+public:
+    ArithmeticStage(RowSource& upstream, const GrayscaleImage& operand, bool subtract)
+        : PipelineStage(upstream), operand(operand), subtract(subtract) {}
+
+    const uint8_t* read_row(int i) {
+        if (subtract) {
+            PixelOps::subtract_saturate(upstream.read_row(i), operand.row(i), output.data(), width);
+        } else {
+            PixelOps::add_saturate(upstream.read_row(i), operand.row(i), output.data(), width);
+        }
+        return output.data();
+    }
+};
+
+FilterPipeline& FilterPipeline::append(StageType type, int kernelSize, double parameter,
+                                       const GrayscaleImage* operand) {
+    Stage stage = { type, kernelSize, parameter, operand };
+    stages.push_back(stage);
+    return *this;
+}
+
+FilterPipeline& FilterPipeline::mean(int kernelSize) {
+    return append(MEAN, kernelSize, 0.0, nullptr);
+}
+
+FilterPipeline& FilterPipeline::gaussian(int kernelSize, double sigma) {
+    return append(GAUSSIAN, kernelSize, sigma, nullptr);
+}
+
+FilterPipeline& FilterPipeline::unsharp(int kernelSize, double amount) {
+    return append(UNSHARP, kernelSize, amount, nullptr);
+}
+
+FilterPipeline& FilterPipeline::add(const GrayscaleImage& operand) {
+    return append(ADD, 0, 0.0, &operand);
+}
+
+FilterPipeline& FilterPipeline::subtract(const GrayscaleImage& operand) {
+    return append(SUBTRACT, 0, 0.0, &operand);
+}
+
+int FilterPipeline::get_radius() const {
+    int radius = 0;
+    for (size_t s = 0; s < stages.size(); s++) {
+        radius += std::max(0, (stages[s].kernelSize - 1) / 2);
+    }
+    return radius;
+}
+
+void FilterPipeline::run(GrayscaleImage& image) const {
+    // Output row i is written only after every stage has pulled input rows up to
+    // i plus its radius, so the rows it overwrites have already been consumed.
+    ImageRowSource source(image);
+    ImageRowSink sink(image);
+    run(source, sink);
+}
+
+void FilterPipeline::run(RowSource& source, RowSink& sink) const {
+    ScopedTimer timer("pipeline.run", (uint64_t) source.get_width() * source.get_height());
+    // 1. Chain one stage per step, each pulling from the one before it.
+    std::vector<std::unique_ptr<RowSource> > chain;
+    RowSource* last = &source;
+    for (size_t s = 0; s < stages.size(); s++) {
+        const Stage& stage = stages[s];
+        RowSource* next = nullptr;
+        switch (stage.type) {
+            case MEAN:
+                next = new MeanStage(*last, stage.kernelSize);
+                break;
+            case GAUSSIAN:
+                next = new GaussianStage(*last, stage.kernelSize, stage.parameter);
+                break;
+            case UNSHARP:
+                next = new UnsharpStage(*last, stage.kernelSize, stage.parameter);
+                break;
+            case ADD:
+            case SUBTRACT:
+                if (stage.operand->get_width() != source.get_width() ||
+                    stage.operand->get_height() != source.get_height()) {
+                    throw std::invalid_argument("Pipeline operand must match the image dimensions.");
+                }
+                next = new ArithmeticStage(*last, *stage.operand, stage.type == SUBTRACT);
+                break;
+        }
+        chain.push_back(std::unique_ptr<RowSource>(next));
+        last = next;
+    }
+
+    // 2. Pull the output rows through the chain in order.
+    for (int i = 0; i < source.get_height(); i++) {
+        sink.write_row(i, last->read_row(i));
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef FILTER_PIPELINE_H
+#define FILTER_PIPELINE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "GrayscaleImage.h"
+
+// Produces an image one row at a time.
+class RowSource {
+public:
+    virtual ~RowSource() {}
+    virtual int get_width() const = 0;
+    virtual int get_height() const = 0;
+
+    // Returns row i. Rows are requested once each, in increasing order from 0,
+    // and the returned pointer only has to stay valid until the next call.
+    virtual const uint8_t* read_row(int i) = 0;
+};
+
+// Consumes an image one row at a time, in increasing order from 0.
+class RowSink {
+public:
+    virtual ~RowSink() {}
+    virtual void write_row(int i, const uint8_t* row) = 0;
+};
+
+// Chain of filters and image operators that runs in a single streaming pass.
+// Each stage keeps only the rolling window of rows its kernel radius needs, so
+// a chain such as gaussian -> unsharp -> add -> subtract never materializes an
+// intermediate image. The output is identical to calling the Filter functions
+// and operators one after another, including under Filter::set_precision, which
+// is read once when run() starts.
+class FilterPipeline {
+private:
+    enum StageType { MEAN, GAUSSIAN, UNSHARP, ADD, SUBTRACT };
+
+    struct Stage {
+        StageType type;
+        int kernelSize;
+        double parameter;               // sigma for GAUSSIAN, amount for UNSHARP
+        const GrayscaleImage* operand;  // Right-hand image for ADD and SUBTRACT
+    };
+
+    std::vector<Stage> stages;
+
+    FilterPipeline& append(StageType type, int kernelSize, double parameter, const GrayscaleImage* operand);
+
+public:
+    // Stages run in the order they are added; the defaults match Filter's.
+    FilterPipeline& mean(int kernelSize = 3);
+    FilterPipeline& gaussian(int kernelSize = 3, double sigma = 1.0);
+    FilterPipeline& unsharp(int kernelSize = 3, double amount = 1.5);
+
+    // The operand is read while the pipeline runs, so it must outlive run().
+    FilterPipeline& add(const GrayscaleImage& operand);
+    FilterPipeline& subtract(const GrayscaleImage& operand);
+
+    // Rows of input each output row depends on, above and below it.
+    int get_radius() const;
+
+    // Runs every stage over image and writes the result back into it in place.
+    void run(GrayscaleImage& image) const;
+
+    // Streams rows from source through every stage into sink. Throws
+    // std::invalid_argument if an operand's size differs from the source's.
+    void run(RowSource& source, RowSink& sink) const;
+};
+
+#endif // FILTER_PIPELINE_H
@@ -1,184 +1,300 @@
 #include "GrayscaleImage.h"
+#include "BufferPool.h"
+#include "LegacyMirror.h"
+#include "PixelOps.h"
+#include "Trace.h"
 #include <iostream>
+#include <cstdlib>
 #include <cstring>  // For memcpy
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 #define STB_IMAGE_WRITE_IMPLEMENTATION
 #include "stb_image_write.h"
 #include <stdexcept>
+#include <string>
+#include <utility>
 
 
+// Allocates the zero-filled pixel slab for a w x h image from the buffer pool.
+void GrayscaleImage::allocate(int w, int h) {
+    width = w;
+    height = h;
+    stride = (w + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    deleter = nullptr;
+    legacyData = nullptr;
+    pixels = nullptr;
+
+    size_t bytes = (size_t) stride * h;
+    if (bytes == 0) {
+        return;
+    }
+    pixels = static_cast<uint8_t*>(BufferPool::acquire(bytes));
+    std::memset(pixels, 0, bytes);
+}
+
+// Frees the pixel slab (back to the pool unless it was adopted) and the legacy
+// int** mirror, if any.
+void GrayscaleImage::release() {
+    if (legacyData != nullptr) {
+        delete[] legacyData[0];
+        delete[] legacyData;
+        legacyData = nullptr;
+    }
+    if (deleter != nullptr) {
+        if (pixels != nullptr) {
+            deleter(pixels);
+        }
+    } else {
+        BufferPool::release(pixels, (size_t) stride * height);
+    }
+    pixels = nullptr;
+    deleter = nullptr;
+}
+
+// Frees a buffer returned by stbi_load.
+static void free_stbi_pixels(void* pixels) {
+    stbi_image_free(pixels);
+}
+
 // Constructor: load from a file
 GrayscaleImage::GrayscaleImage(const char* filename) {
 
     // Image loading code using stbi
-    int channels;
-    unsigned char* image = stbi_load(filename, &width, &height, &channels, STBI_grey);
+    ScopedTimer timer("image.decode");
+    int channels, w, h;
+    unsigned char* image = stbi_load(filename, &w, &h, &channels, STBI_grey);
     if (image == nullptr) {
         std::cerr << "Error: Could not load image " << filename << std::endl;
         exit(1);
     }
+    timer.set_pixels((uint64_t) w * h);
+    timer.set_bytes((uint64_t) w * h);
 
-    // Dynamically allocate memory for a 2D matrix based on the given dimensions.
-    data = new int *[height];
-    for (int i = 0; i < height; i++) {
-        data[i] = new int[width];
-    }
-
-    // Fill the matrix with pixel values from the image
-    for (int i = 0; i < height; i++) {
-        for (int j = 0; j < width; j++) {
-            int pixelValue = (int) image[i * width + j];
-            data[i][j] = pixelValue;
+    // Adopt the tightly packed stbi rows as they are; stbi_image_free releases them.
+    pixels = image;
+    width = w;
+    height = h;
+    stride = w;
+    deleter = free_stbi_pixels;
+    legacyData = nullptr;
+}
 
-        }
+// Load from a file, reporting failure with an exception
+GrayscaleImage GrayscaleImage::load(const char* filename) {
+    ScopedTimer timer("image.decode");
+    int channels, w, h;
+    unsigned char* image = stbi_load(filename, &w, &h, &channels, STBI_grey);
+    if (image == nullptr) {
+        throw std::runtime_error(std::string("Could not load image ") + filename);
     }
-
-    // Free the dynamically allocated memory of stbi image
-    stbi_image_free(image);
+    timer.set_pixels((uint64_t) w * h);
+    timer.set_bytes((uint64_t) w * h);
+    return GrayscaleImage(image, w, h, w, free_stbi_pixels);
 }
 
 // Constructor: initialize from a pre-existing data matrix
 GrayscaleImage::GrayscaleImage(int** inputData, int h, int w) {
     // Initialize the image with a pre-existing data matrix by copying the values.
-    // Don't forget to dynamically allocate memory for the matrix.
-    height = h;
-    width = w;
-    data = new int*[height];
-    for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
-    }
+    allocate(w, h);
     for (int i = 0; i < height; ++i) {
+        uint8_t* dst = row(i);
         for (int j = 0; j < width; ++j) {
-            data[i][j] = inputData[i][j];
+            dst[j] = static_cast<uint8_t>(inputData[i][j]);
         }
     }
 }
 
 // Constructor to create a blank image of given width and height
-GrayscaleImage::GrayscaleImage(int w, int h) : width(w), height(h) {
-    // Just dynamically allocate the memory for the new matrix.
-    data = new int*[height];
-    for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
-    }
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            data[i][j] = 0;
-        }
-    }
+GrayscaleImage::GrayscaleImage(int w, int h) {
+    allocate(w, h);
 }
 
-// Copy constructor
-GrayscaleImage::GrayscaleImage(const GrayscaleImage& other) {
-    // Copy constructor: dynamically allocate memory and 
+// Deleter for borrowed buffers, which stay with the caller.
+static void keep_pixels(void*) {
+}
 
-    height = other.get_height();
-    width = other.get_width();
-    data = new int*[height];
-    for (int i = 0; i < height; ++i) {
-        data[i] = new int[width];
+// Constructor: adopt an existing pixel buffer without copying
+GrayscaleImage::GrayscaleImage(uint8_t* buffer, int w, int h, int stride, PixelDeleter deleter)
+    : pixels(buffer), width(w), height(h), stride(stride),
+      deleter(deleter != nullptr ? deleter : keep_pixels), legacyData(nullptr) {
+    if (stride < w) {
+        throw std::invalid_argument("The stride must be at least the width.");
     }
+}
 
-    // copy pixel values from another image.
-    for (int i = 0; i < other.get_height(); ++i) {
-        for (int j = 0; j < other.get_width(); ++j) {
-            data[i][j] = other.get_pixel(i,j);
+// Copy constructor
+GrayscaleImage::GrayscaleImage(const GrayscaleImage& other) {
+    // Two pool-owned slabs of the same size share a layout, padding included, so
+    // one copy covers them. An adopted buffer may have a matching stride but a
+    // last row that ends at the width, or padding that is not zero, so it copies
+    // row by row.
+    allocate(other.width, other.height);
+    Trace::count("bytes_copied", (int64_t) width * height);
+    if (pixels != nullptr && other.deleter == nullptr && other.stride == stride) {
+        std::memcpy(pixels, other.pixels, (size_t) stride * height);
+    } else if (pixels != nullptr) {
+        for (int i = 0; i < height; i++) {
+            std::memcpy(row(i), other.row(i), width);
         }
     }
 }
 
+// Move constructor
+GrayscaleImage::GrayscaleImage(GrayscaleImage&& other) noexcept
+    : pixels(other.pixels), width(other.width), height(other.height),
+      stride(other.stride), deleter(other.deleter), legacyData(other.legacyData) {
+    other.pixels = nullptr;
+    other.deleter = nullptr;
+    other.legacyData = nullptr;
+    other.width = 0;
+    other.height = 0;
+    other.stride = 0;
+}
+
 // Destructor
 GrayscaleImage::~GrayscaleImage() {
-    // Destructor: deallocate memory for the matrix.
-    for (int i = 0; i < height; ++i) {
-        delete[] data[i];
+    release();
+}
+
+// Copy assignment
+GrayscaleImage& GrayscaleImage::operator=(const GrayscaleImage& other) {
+    if (this != &other) {
+        GrayscaleImage copy(other);
+        *this = std::move(copy);
     }
-    delete[] data;
+    return *this;
+}
+
+// Move assignment
+GrayscaleImage& GrayscaleImage::operator=(GrayscaleImage&& other) noexcept {
+    if (this != &other) {
+        release();
+        pixels = other.pixels;
+        deleter = other.deleter;
+        legacyData = other.legacyData;
+        width = other.width;
+        height = other.height;
+        stride = other.stride;
+        other.pixels = nullptr;
+        other.deleter = nullptr;
+        other.legacyData = nullptr;
+        other.width = 0;
+        other.height = 0;
+        other.stride = 0;
+    }
+    return *this;
 }
 
 // Equality operator
 bool GrayscaleImage::operator==(const GrayscaleImage& other) const {
-    for(int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++) {
+    // Images of different sizes are never equal.
+    if (width != other.width || height != other.height) {
+        return false;
+    }
 
-            // Check if two images have the same dimensions and pixel values.
-            if(this->get_pixel(i,j) != other.get_pixel(i,j) ) {
-                return false;
-            }
+    // Compare row by row and stop at the first differing pixel.
+    for (int i = 0; i < height; i++) {
+        if (PixelOps::first_mismatch(row(i), other.row(i), width) != (size_t) width) {
+            return false;
         }
-
-        // If they do, return true.
-        return true;
     }
+    return true;
 }
 
 // Addition operator
-GrayscaleImage GrayscaleImage::operator+(const GrayscaleImage& other) const {
+GrayscaleImage GrayscaleImage::operator+(const GrayscaleImage& other) const & {
+    if (width != other.width || height != other.height) {
+        throw std::invalid_argument("Images must have the same dimensions to be added.");
+    }
+    ScopedTimer timer("image.add", (uint64_t) width * height, 3 * (uint64_t) width * height);
+
     // Create a new image for the result
-    GrayscaleImage result(this->get_height(), this->get_width());
+    GrayscaleImage result(width, height);
 
     // Add two images' pixel values and return a new image, clamping the results.
-    for(int i = 0; i < this->get_height(); i++) {
-        for(int j = 0; j < this->get_width(); j++) {
-            if(this->get_pixel(i,j) + other.get_pixel(i,j) >= 255) {
-                result.set_pixel(i,j,255);
-            }else {
-                int addedPixel = this->get_pixel(i,j) + other.get_pixel(i,j);
-                result.set_pixel(i,j,addedPixel);
-            }
-        }
+    for (int i = 0; i < height; i++) {
+        PixelOps::add_saturate(row(i), other.row(i), result.row(i), width);
     }
     return result;
 }
 
 // Subtraction operator
-GrayscaleImage GrayscaleImage::operator-(const GrayscaleImage& other) const {
+GrayscaleImage GrayscaleImage::operator-(const GrayscaleImage& other) const & {
+    if (width != other.width || height != other.height) {
+        throw std::invalid_argument("Images must have the same dimensions to be subtracted.");
+    }
+    ScopedTimer timer("image.subtract", (uint64_t) width * height, 3 * (uint64_t) width * height);
+
     // Create a new image for the result
     GrayscaleImage result(width, height);
 
     // Subtract pixel values of two images and return a new image, clamping the results.
-    for(int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++) {
-            if(this->get_pixel(i,j) - other.get_pixel(i,j) <= 0) {
-                result.set_pixel(i,j,0);
-            } else {
-                int addedPixel = this->get_pixel(i,j) - other.get_pixel(i,j);
-                result.set_pixel(i,j,addedPixel);
-            }
-        }
+    for (int i = 0; i < height; i++) {
+        PixelOps::subtract_saturate(row(i), other.row(i), result.row(i), width);
     }
     return result;
 }
 
-// Get a specific pixel value
-int GrayscaleImage::get_pixel(int row, int col) const {
-    return data[row][col];
+// Addition on a temporary: the result reuses its pixels
+GrayscaleImage GrayscaleImage::operator+(const GrayscaleImage& other) && {
+    *this += other;
+    return std::move(*this);
 }
 
-// Set a specific pixel value
-void GrayscaleImage::set_pixel(int row, int col, int value) {
-    data[row][col] = value;
+// Subtraction on a temporary: the result reuses its pixels
+GrayscaleImage GrayscaleImage::operator-(const GrayscaleImage& other) && {
+    *this -= other;
+    return std::move(*this);
 }
 
-// Function to save the image to a PNG file
-void GrayscaleImage::save_to_file(const char* filename) const {
-    // Create a buffer to hold the image data in the format stb_image_write expects
-    unsigned char* imageBuffer = new unsigned char[width * height];
-
+// In-place addition, clamping at 255
+GrayscaleImage& GrayscaleImage::operator+=(const GrayscaleImage& other) {
+    if (width != other.width || height != other.height) {
+        throw std::invalid_argument("Images must have the same dimensions to be added.");
+    }
+    ScopedTimer timer("image.add", (uint64_t) width * height, 3 * (uint64_t) width * height);
+    for (int i = 0; i < height; i++) {
+        PixelOps::add_saturate(row(i), other.row(i), row(i), width);
+    }
+    return *this;
+}
 
-    // Fill the buffer with pixel data (convert int to unsigned char)
-    for (int i = 0; i < height; ++i) {
-        for (int j = 0; j < width; ++j) {
-            imageBuffer[i * width + j] = static_cast<unsigned char>(data[i][j]);
-        }
+// In-place subtraction, clamping at 0
+GrayscaleImage& GrayscaleImage::operator-=(const GrayscaleImage& other) {
+    if (width != other.width || height != other.height) {
+        throw std::invalid_argument("Images must have the same dimensions to be subtracted.");
     }
+    ScopedTimer timer("image.subtract", (uint64_t) width * height, 3 * (uint64_t) width * height);
+    for (int i = 0; i < height; i++) {
+        PixelOps::subtract_saturate(row(i), other.row(i), row(i), width);
+    }
+    return *this;
+}
 
-    // Write the buffer to a PNG file
-    if (!stbi_write_png(filename, width, height, 1, imageBuffer, width)) {
+// Function to save the image to a PNG file
+bool GrayscaleImage::save_to_file(const char* filename) const {
+    ScopedTimer timer("image.encode", (uint64_t) width * height, (uint64_t) width * height);
+    // The slab already holds 8-bit rows, so stbi can write it directly using the stride.
+    if (!stbi_write_png(filename, width, height, 1, pixels, stride)) {
         std::cerr << "Error: Could not save image to file " << filename << std::endl;
+        return false;
     }
+    return true;
+}
 
-    // Clean up the allocated buffer
-    delete[] imageBuffer;
+// Builds (or refreshes) the int** mirror of the pixels for legacy callers, under
+// the lock.
+const int* const* GrayscaleImage::get_data() const {
+    std::lock_guard<std::mutex> lock(legacyMutex);
+    if (legacyData == nullptr) {
+        legacyData = new int*[height > 0 ? height : 1];
+        legacyData[0] = new int[(size_t) width * height]();
+        for (int i = 1; i < height; ++i) {
+            legacyData[i] = legacyData[0] + (size_t) i * width;
+        }
+    }
+    for (int i = 0; i < height; ++i) {
+        refresh_int_mirror(legacyData[i], row(i), (size_t) width);
+    }
+    return legacyData;
 }
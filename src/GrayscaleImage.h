@@ -1,50 +1,151 @@
 #ifndef GRAYSCALE_IMAGE_H
 #define GRAYSCALE_IMAGE_H
 
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+// Non-owning window over stride-padded 8-bit pixel rows.
+template <typename T>
+struct BasicImageView {
+    T* data;
+    int width, height;
+    int stride; // Bytes between the starts of two consecutive rows.
+
+    T* row(int r) const { return data + (std::ptrdiff_t) r * stride; }
+
+    // Sub-window starting at (r, c) with the given size, sharing the same rows.
+    BasicImageView sub(int r, int c, int h, int w) const {
+        BasicImageView view = { row(r) + c, w, h, stride };
+        return view;
+    }
+};
+
+typedef BasicImageView<uint8_t> ImageView;
+typedef BasicImageView<const uint8_t> ConstImageView;
+
+// Rectangle of pixels: rows [top, top + height), columns [left, left + width).
+struct ImageRect {
+    int top, left;
+    int height, width;
+};
+
 class GrayscaleImage {
+public:
+    // Frees an adopted pixel buffer, e.g. stbi_image_free.
+    typedef void (*PixelDeleter)(void* pixels);
+
 private:
-    int** data;
+    // One contiguous slab, `stride` bytes per row. Slabs the image allocates itself
+    // come from the BufferPool, are ALIGNMENT-aligned and keep their row padding
+    // at zero; adopted buffers keep whatever layout they came with.
+    uint8_t* pixels;
     int width, height;
+    int stride;
+    PixelDeleter deleter;   // nullptr for pool-owned slabs
+
+    // int** mirror of the pixels handed out by get_data(), built on demand and
+    // refreshed under legacyMutex.
+    mutable int** legacyData;
+    mutable std::mutex legacyMutex;
 
+    void allocate(int w, int h);
+    void release();
 
 public:
-    // Constructor: loads an image from a file
+    // Row starts and strides of the slabs an image allocates itself (blank images
+    // and copies) are multiples of this many bytes. Adopted buffers, including
+    // images loaded from a file and results built on them in place, keep their
+    // own stride, so code must not assume aligned rows.
+    static const int ALIGNMENT = 64;
+
+    // Constructor: loads an image from a file. The decoded rows are adopted as
+    // they are, tightly packed with stride == width.
     GrayscaleImage(const char* filename);
 
+    // Loads an image from a file like the constructor, but throws
+    // std::runtime_error instead of exiting when it cannot be decoded.
+    static GrayscaleImage load(const char* filename);
+
     // Constructor: initializes from a 2D data matrix
     GrayscaleImage(int** inputData, int h, int w);
 
     // Constructor to create a blank image of given width and height
     GrayscaleImage(int w, int h);
 
+    // Constructor: adopts an existing buffer of h rows, `stride` bytes apart, without
+    // copying it. The image frees it with deleter (e.g. stbi_image_free) when done;
+    // with a null deleter the buffer stays the caller's and must outlive the image.
+    // Throws std::invalid_argument, leaving the buffer with the caller, if stride < w.
+    GrayscaleImage(uint8_t* buffer, int w, int h, int stride, PixelDeleter deleter);
+
     // Copy constructor
     GrayscaleImage(const GrayscaleImage& other);
 
+    // Move constructor: takes over the pixel buffer, leaving other empty
+    GrayscaleImage(GrayscaleImage&& other) noexcept;
+
     // Destructor
     ~GrayscaleImage();
 
-    // Operator overloads
+    // Assignment operators
+    GrayscaleImage& operator=(const GrayscaleImage& other);
+    GrayscaleImage& operator=(GrayscaleImage&& other) noexcept;
+
+    // Operator overloads. Addition and subtraction saturate at 255 and 0 and
+    // throw std::invalid_argument when the dimensions differ. The in-place forms,
+    // and the binary ones on a temporary left-hand side, reuse the existing pixels,
+    // so a chain such as (a + b - c) allocates a single image.
     bool operator==(const GrayscaleImage& other) const;
-    GrayscaleImage operator+(const GrayscaleImage& other) const;
-    GrayscaleImage operator-(const GrayscaleImage& other) const;
+    GrayscaleImage operator+(const GrayscaleImage& other) const &;
+    GrayscaleImage operator+(const GrayscaleImage& other) &&;
+    GrayscaleImage operator-(const GrayscaleImage& other) const &;
+    GrayscaleImage operator-(const GrayscaleImage& other) &&;
+    GrayscaleImage& operator+=(const GrayscaleImage& other);
+    GrayscaleImage& operator-=(const GrayscaleImage& other);
 
     // Method to get image dimensions
     int get_width() const { return width; }
     int get_height() const { return height; }
 
+    // Distance in bytes between the starts of two consecutive rows
+    int get_stride() const { return stride; }
+
     // Get a specific pixel value
-    int get_pixel(int row, int col) const;
+    int get_pixel(int row, int col) const {
+        return pixels[(std::ptrdiff_t) row * stride + col];
+    }
 
     // Set a specific pixel value
-    void set_pixel(int row, int col, int value);
+    void set_pixel(int row, int col, int value) {
+        pixels[(std::ptrdiff_t) row * stride + col] = static_cast<uint8_t>(value);
+    }
 
-    // Function to write the image data back to a PNG file
-    void save_to_file(const char* filename) const;
+    // Pointer to the first pixel of the given row
+    uint8_t* row(int r) { return pixels + (std::ptrdiff_t) r * stride; }
+    const uint8_t* row(int r) const { return pixels + (std::ptrdiff_t) r * stride; }
 
-    // Getter function for data.
-    int** get_data() const {
-        return data;
+    // Views over the whole image
+    ImageView view() {
+        ImageView v = { pixels, width, height, stride };
+        return v;
+    }
+    ConstImageView view() const {
+        ConstImageView v = { pixels, width, height, stride };
+        return v;
     }
+
+    // Function to write the image data back to a PNG file; returns false if it failed
+    bool save_to_file(const char* filename) const;
+
+    // Getter function for data.
+    // Compatibility shim: returns a read-only int copy of the pixels that is owned
+    // by the image and refreshed on every call. To change pixels use set_pixel()
+    // or row(). Safe to call from several threads on an image nobody is modifying;
+    // a refresh after an edit races with readers of the pointer an earlier call
+    // returned.
+    __attribute__((deprecated("copies the pixels; use row(), view() or set_pixel()")))
+    const int* const* get_data() const;
 };
 
 #endif // GRAYSCALE_IMAGE_H
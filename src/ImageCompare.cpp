@@ -0,0 +1,249 @@
+#include "ImageCompare.h"
+#include "PixelOps.h"
+#include "TileExecutor.h"
+#include "Trace.h"
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <mutex>
+
+// SSIM stabilizers for 8-bit pixels, (0.01 * 255)^2 and (0.03 * 255)^2.
+static const double SSIM_C1 = 6.5025;
+static const double SSIM_C2 = 58.5225;
+
+// Histograms kept side by side in a band, so that runs of equal differences do
+// not serialize on incrementing the same counter.
+static const int HISTOGRAM_LANES = 4;
+
+// Integer statistics of a band; merged in any order, they add up the same.
+struct BandTotals {
+    uint64_t histogram[256];
+    uint64_t identicalPixels;    // Counted apart from histogram[0], row by row
+    int firstRow, firstColumn;
+    int top, left, bottom, right;
+
+    BandTotals() : identicalPixels(0), firstRow(-1), firstColumn(-1),
+                   top(INT_MAX), left(INT_MAX), bottom(-1), right(-1) {
+        std::memset(histogram, 0, sizeof(histogram));
+    }
+};
+
+// SSIM of one block from its pixel count and sums.
+static double block_ssim(int count, int64_t sumA, int64_t sumB, int64_t sumAA, int64_t sumBB, int64_t sumAB) {
+    double meanA = (double) sumA / count;
+    double meanB = (double) sumB / count;
+    double varianceA = (double) sumAA / count - meanA * meanA;
+    double varianceB = (double) sumBB / count - meanB * meanB;
+    double covariance = (double) sumAB / count - meanA * meanB;
+    return ((2 * meanA * meanB + SSIM_C1) * (2 * covariance + SSIM_C2)) /
+           ((meanA * meanA + meanB * meanB + SSIM_C1) * (varianceA + varianceB + SSIM_C2));
+}
+
+// Columns whose SSIM sums are gathered at a time; a multiple of SSIM_BLOCK.
+static const int COLUMN_CHUNK = 64;
+
+// Per-column sums of A, B, AA, BB and AB over the rows of a block row.
+struct ColumnSums {
+    int sum[5][COLUMN_CHUNK];
+};
+
+// Adds count pixels of a row pair to the column sums. Whole chunks pass the
+// constant COLUMN_CHUNK, so the loop has a fixed trip count over local sums and
+// vectorizes.
+template <int count>
+static void add_columns(const uint8_t* a, const uint8_t* b, ColumnSums& sums) {
+    for (int j = 0; j < count; j++) {
+        int x = a[j], y = b[j];
+        sums.sum[0][j] += x;
+        sums.sum[1][j] += y;
+        sums.sum[2][j] += x * x;
+        sums.sum[3][j] += y * y;
+        sums.sum[4][j] += x * y;
+    }
+}
+
+static void add_columns(const uint8_t* a, const uint8_t* b, int count, ColumnSums& sums) {
+    for (int j = 0; j < count; j++) {
+        int x = a[j], y = b[j];
+        sums.sum[0][j] += x;
+        sums.sum[1][j] += y;
+        sums.sum[2][j] += x * x;
+        sums.sum[3][j] += y * y;
+        sums.sum[4][j] += x * y;
+    }
+}
+
+// Sum of the SSIM of every block in rows [top, bottom), one block row, a chunk
+// of columns at a time.
+static double block_row_ssim(ConstImageView actual, ConstImageView expected, int top, int bottom) {
+    const int block = ImageCompare::SSIM_BLOCK;
+    int width = actual.width;
+    double total = 0;
+    for (int chunk = 0; chunk < width; chunk += COLUMN_CHUNK) {
+        int count = std::min(COLUMN_CHUNK, width - chunk);
+        ColumnSums columns;
+        std::memset(&columns, 0, sizeof(columns));
+        for (int i = top; i < bottom; i++) {
+            if (count == COLUMN_CHUNK) {
+                add_columns<COLUMN_CHUNK>(actual.row(i) + chunk, expected.row(i) + chunk, columns);
+            } else {
+                add_columns(actual.row(i) + chunk, expected.row(i) + chunk, count, columns);
+            }
+        }
+        for (int left = 0; left < count; left += block) {
+            int right = std::min(left + block, count);
+            int64_t blockSums[5] = { 0, 0, 0, 0, 0 };
+            for (int k = 0; k < 5; k++) {
+                for (int j = left; j < right; j++) {
+                    blockSums[k] += columns.sum[k][j];
+                }
+            }
+            total += block_ssim((bottom - top) * (right - left), blockSums[0], blockSums[1],
+                                blockSums[2], blockSums[3], blockSums[4]);
+        }
+    }
+    return total;
+}
+
+ImageComparison ImageCompare::compare(const GrayscaleImage& actual, const GrayscaleImage& expected,
+                                      const CompareOptions& options) {
+    return compare(actual.view(), expected.view(), options);
+}
+
+ImageComparison ImageCompare::compare(ConstImageView actual, ConstImageView expected,
+                                      const CompareOptions& options) {
+    ImageComparison result;
+    result.sameSize = actual.width == expected.width && actual.height == expected.height;
+    result.equal = false;
+    result.firstRow = result.firstColumn = -1;
+    result.differingPixels = 0;
+    ImageRect emptyBox = { 0, 0, 0, 0 };
+    result.differenceBox = emptyBox;
+    result.maxDifference = 0;
+    result.mse = 0;
+    result.psnr = std::numeric_limits<double>::infinity();
+    result.ssim = options.ssim ? 1.0 : 0.0;
+    result.histogram.assign(256, 0);
+    if (!result.sameSize) {
+        result.psnr = 0;
+        result.ssim = 0;
+        return result;
+    }
+    int width = actual.width;
+    int height = actual.height;
+    uint64_t pixelCount = (uint64_t) width * height;
+    ScopedTimer timer("compare.images", pixelCount, 2 * pixelCount);
+
+    // 1. One task per band of block rows. Rows that match exactly are found with
+    //    the vectorized compare and only counted; the rest go through the
+    //    per-pixel histogram, and the first differing pixel and the box.
+    const int block = SSIM_BLOCK;
+    int blockRows = (height + block - 1) / block;
+    std::vector<double> blockRowSsim(blockRows, 0.0);
+    BandTotals totals;
+    std::mutex totalsMutex;
+    TileExecutor::for_each_band(blockRows, 0, [&](const RowBand& band) {
+        BandTotals local;
+        uint64_t lanes[HISTOGRAM_LANES][256];
+        std::memset(lanes, 0, sizeof(lanes));
+        for (int br = band.begin; br < band.end; br++) {
+            int top = br * block;
+            int bottom = std::min(top + block, height);
+            bool blockIdentical = true;
+            for (int i = top; i < bottom; i++) {
+                const uint8_t* a = actual.row(i);
+                const uint8_t* b = expected.row(i);
+                int start = (int) PixelOps::first_mismatch(a, b, width);
+                local.identicalPixels += start;
+                if (start == width) {
+                    continue;
+                }
+                blockIdentical = false;
+                int first = -1, last = -1;
+                for (int j = start; j < width; j++) {
+                    int difference = std::abs(a[j] - b[j]);
+                    lanes[j & (HISTOGRAM_LANES - 1)][difference]++;
+                    if (difference > options.tolerance) {
+                        first = first < 0 ? j : first;
+                        last = j;
+                    }
+                }
+                if (first >= 0) {
+                    if (local.firstRow < 0) {
+                        local.firstRow = i;
+                        local.firstColumn = first;
+                    }
+                    local.top = std::min(local.top, i);
+                    local.bottom = i + 1;
+                    local.left = std::min(local.left, first);
+                    local.right = std::max(local.right, last + 1);
+                }
+            }
+
+            // Identical blocks have an SSIM of exactly 1.
+            if (options.ssim) {
+                blockRowSsim[br] = blockIdentical ? (double) ((width + block - 1) / block)
+                                                  : block_row_ssim(actual, expected, top, bottom);
+            }
+        }
+        for (int lane = 0; lane < HISTOGRAM_LANES; lane++) {
+            for (int d = 0; d < 256; d++) {
+                local.histogram[d] += lanes[lane][d];
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(totalsMutex);
+        for (int d = 0; d < 256; d++) {
+            totals.histogram[d] += local.histogram[d];
+        }
+        totals.identicalPixels += local.identicalPixels;
+        if (local.firstRow >= 0 && (totals.firstRow < 0 || local.firstRow < totals.firstRow)) {
+            totals.firstRow = local.firstRow;
+            totals.firstColumn = local.firstColumn;
+        }
+        totals.top = std::min(totals.top, local.top);
+        totals.left = std::min(totals.left, local.left);
+        totals.bottom = std::max(totals.bottom, local.bottom);
+        totals.right = std::max(totals.right, local.right);
+    });
+
+    // 2. Everything else follows from the histogram.
+    totals.histogram[0] += totals.identicalPixels;
+    uint64_t squaredSum = 0;
+    for (int d = 0; d < 256; d++) {
+        result.histogram[d] = totals.histogram[d];
+        squaredSum += totals.histogram[d] * (uint64_t) (d * d);
+        if (totals.histogram[d] > 0) {
+            result.maxDifference = d;
+        }
+        if (d > options.tolerance) {
+            result.differingPixels += totals.histogram[d];
+        }
+    }
+    result.equal = result.differingPixels == 0;
+    if (!result.equal) {
+        result.firstRow = totals.firstRow;
+        result.firstColumn = totals.firstColumn;
+        ImageRect box = { totals.top, totals.left, totals.bottom - totals.top, totals.right - totals.left };
+        result.differenceBox = box;
+    }
+    if (pixelCount > 0) {
+        result.mse = (double) squaredSum / pixelCount;
+        if (squaredSum > 0) {
+            result.psnr = 10.0 * std::log10(255.0 * 255.0 / result.mse);
+        }
+    }
+
+    // 3. Mean SSIM, summed in block row order so it does not depend on the bands.
+    if (options.ssim && blockRows > 0 && width > 0) {
+        double ssimSum = 0;
+        for (int br = 0; br < blockRows; br++) {
+            ssimSum += blockRowSsim[br];
+        }
+        result.ssim = ssimSum / ((double) blockRows * ((width + block - 1) / block));
+    }
+    return result;
+}
@@ -0,0 +1,51 @@
+#ifndef IMAGE_COMPARE_H
+#define IMAGE_COMPARE_H
+
+#include <cstdint>
+#include <vector>
+
+#include "GrayscaleImage.h"
+
+// What ImageCompare::compare measures.
+struct CompareOptions {
+    int tolerance;       // Pixels whose difference is at most this count as equal
+    bool ssim;           // Compute the SSIM, which reads the differing blocks a second time
+
+    CompareOptions() : tolerance(0), ssim(true) {}
+};
+
+// Everything one pass over two images finds out about their difference. When
+// the sizes differ nothing else is measured, and the images are not equal.
+struct ImageComparison {
+    bool sameSize;
+    bool equal;                  // No pixel differs by more than the tolerance
+    int firstRow, firstColumn;   // First such pixel in row-major order, or -1
+    uint64_t differingPixels;
+    ImageRect differenceBox;     // Smallest rectangle holding them; empty if equal
+
+    int maxDifference;           // Largest |actual - expected|
+    double mse;                  // Mean squared difference
+    double psnr;                 // In dB, against 255; infinity for identical images
+    double ssim;                 // Mean SSIM over SSIM_BLOCK-square blocks; 0 unless options.ssim
+
+    // histogram[d] counts the pixels with |actual - expected| == d.
+    std::vector<uint64_t> histogram;
+};
+
+// Image comparison for golden and regression checks. A single multi-threaded
+// pass reads both images in place: rows are first compared with the vectorized
+// PixelOps::first_mismatch, and only rows that differ go through the per-pixel
+// statistics, so comparing identical images costs little more than operator==.
+class ImageCompare {
+public:
+    // Side of the blocks the SSIM is computed over. Blocks do not overlap; those
+    // cut off by the right and bottom edges use the pixels they have.
+    static const int SSIM_BLOCK = 8;
+
+    static ImageComparison compare(const GrayscaleImage& actual, const GrayscaleImage& expected,
+                                   const CompareOptions& options = CompareOptions());
+    static ImageComparison compare(ConstImageView actual, ConstImageView expected,
+                                   const CompareOptions& options = CompareOptions());
+};
+
+#endif // IMAGE_COMPARE_H
@@ -0,0 +1,283 @@
+#include "ImagePyramid.h"
+#include "BufferPool.h"
+#include "Filter.h"
+#include "FilterKernels.h"
+#include "KernelCache.h"
+#include "TileExecutor.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+#include <utility>
+
+// Coarsest level a blur may run at, and the smallest sigma it may be left with
+// there; below it the coarse grid is too sparse for the upsampling to hide.
+static const int MAX_BLUR_LEVEL = 4;
+static const double MIN_COARSE_SIGMA = 1.5;
+
+// Smallest width and height a level must keep for a blur to run on it.
+static const int MIN_LEVEL_SIZE = 8;
+
+// BLUR_AUTO takes the pyramid path only when it is estimated to cost less than
+// this fraction of the direct path.
+static const double AUTO_COST_RATIO = 0.5;
+
+// Rows whose exact blur a report compares against.
+static const int SAMPLED_ROWS = 8;
+
+// Rough multiply-adds per output pixel of the binomial downsample (5 vertical
+// taps over two columns, then 5 horizontal ones) and of the bilinear upsample.
+static const double DOWNSAMPLE_COST = 15.0;
+static const double UPSAMPLE_COST = 4.0;
+
+// Fractional bits of the bilinear weights.
+static const int BILINEAR_BITS = 8;
+
+ImagePyramid::ImagePyramid(const GrayscaleImage& image) : base(new GrayscaleImage(image)) {}
+
+ImagePyramid::ImagePyramid(GrayscaleImage&& image) : base(new GrayscaleImage(std::move(image))) {}
+
+const GrayscaleImage& ImagePyramid::level(int index) {
+    if (index < 0 || index >= get_level_count()) {
+        throw std::out_of_range("Pyramid level " + std::to_string(index) + " does not exist");
+    }
+    if (index == 0) {
+        return *base;
+    }
+    std::lock_guard<std::mutex> lock(mutex);
+    while ((int) levels.size() < index) {
+        const GrayscaleImage& finer = levels.empty() ? *base : *levels.back();
+        levels.emplace_back(new GrayscaleImage(downsample(finer)));
+    }
+    return *levels[index - 1];
+}
+
+int ImagePyramid::get_cached_levels() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return 1 + (int) levels.size();
+}
+
+int ImagePyramid::get_level_count() const {
+    int width = base->get_width();
+    int height = base->get_height();
+    int count = 1;
+    while (width > 1 || height > 1) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        count++;
+    }
+    return count;
+}
+
+BlurPlan ImagePyramid::plan(int kernelSize, double sigma) const {
+    BlurPlan plan;
+    int radius = (kernelSize - 1) / 2;
+    plan.directCost = 2.0 * (2 * radius + 1);
+    plan.path = BLUR_DIRECT;
+    plan.level = 0;
+    plan.coarseSigma = sigma;
+    plan.pyramidCost = plan.directCost;
+
+    // 1. Level n already carries a blur of variance (4^n - 1) / 3 from the binomial
+    //    filters, in level 0 pixels. Pick the coarsest level that leaves enough
+    //    blur to do there, and where the kernel still spans more than one pixel.
+    int maxLevel = 0;
+    int width = base->get_width();
+    int height = base->get_height();
+    while (maxLevel < MAX_BLUR_LEVEL && (width + 1) / 2 >= MIN_LEVEL_SIZE && (height + 1) / 2 >= MIN_LEVEL_SIZE) {
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+        maxLevel++;
+    }
+    for (int n = maxLevel; n >= 1; n--) {
+        double scale = (double) (1 << n);
+        double remaining = sigma * sigma - (scale * scale - 1) / 3;
+        double coarseSigma = remaining > 0 ? std::sqrt(remaining) / scale : 0;
+        if (coarseSigma >= MIN_COARSE_SIGMA && radius >= (1 << n)) {
+            plan.level = n;
+            plan.coarseSigma = coarseSigma;
+            break;
+        }
+    }
+    if (plan.level == 0) {
+        return plan;
+    }
+
+    // 2. Cost of the levels still to build, the coarse blur and the upsample.
+    int cached = get_cached_levels();
+    double cost = UPSAMPLE_COST;
+    for (int n = std::max(cached, 1); n <= plan.level; n++) {
+        cost += DOWNSAMPLE_COST / (double) (1 << (2 * n));
+    }
+    int coarseRadius = (radius + (1 << plan.level) - 1) >> plan.level;
+    cost += 2.0 * (2 * coarseRadius + 1) / (double) (1 << (2 * plan.level));
+    plan.pyramidCost = cost;
+    if (cost < AUTO_COST_RATIO * plan.directCost) {
+        plan.path = BLUR_PYRAMID;
+    }
+    return plan;
+}
+
+// Exact Gaussian blur of one row of image, as Filter::apply_gaussian_smoothing
+// computes it with PRECISION_EXACT.
+static void exact_row(const GrayscaleImage& image, const GaussianKernel& kernel, BorderMode border,
+                      int row, uint8_t* out) {
+    int width = image.get_width();
+    PooledBuffer<double> horizontal((size_t) kernel.size * width);
+    PooledBuffer<uint8_t> padded(width + 2 * kernel.radius);
+    PooledBuffer<double> column(width);
+    std::vector<const double*> horizontalRows(kernel.size);
+    std::vector<const uint8_t*> sourceRows(kernel.size);
+    for (int a = 0; a < kernel.size; a++) {
+        int mapped = border_index(row + a - kernel.radius, image.get_height(), border);
+        horizontalRows[a] = nullptr;
+        sourceRows[a] = nullptr;
+        if (mapped >= 0) {
+            double* sums = &horizontal[(size_t) a * width];
+            FilterKernels::gaussian_horizontal(image.row(mapped), width, kernel, padded.data(), sums, border);
+            horizontalRows[a] = sums;
+            sourceRows[a] = image.row(mapped);
+        }
+    }
+    FilterKernels::gaussian_vertical(horizontalRows.data(), sourceRows.data(), width, kernel,
+                                     column.data(), out, border);
+}
+
+GrayscaleImage ImagePyramid::gaussian(int kernelSize, double sigma, BorderMode border,
+                                      BlurPath path, BlurReport* report) {
+    const GrayscaleImage& image = *base;
+    BlurPlan blurPlan = plan(kernelSize, sigma);
+    if (path != BLUR_AUTO) {
+        blurPlan.path = path;
+    }
+    if (blurPlan.level == 0) {
+        blurPlan.path = BLUR_DIRECT;
+    }
+
+    // 1. Direct path: the ordinary filter at full resolution.
+    if (blurPlan.path == BLUR_DIRECT) {
+        GrayscaleImage result = image;
+        Filter::apply_gaussian_smoothing(result, kernelSize, sigma, border);
+        if (report != nullptr) {
+            report->plan = blurPlan;
+            report->sampledRows = 0;
+            report->maxError = 0;
+            report->meanError = 0;
+        }
+        return result;
+    }
+
+    // 2. Pyramid path: blur the coarse level with the remaining sigma and a kernel
+    //    covering the same extent, then bring it back to full size.
+    int radius = (kernelSize - 1) / 2;
+    int coarseRadius = (radius + (1 << blurPlan.level) - 1) >> blurPlan.level;
+    GrayscaleImage coarse = level(blurPlan.level);
+    Filter::apply_gaussian_smoothing(coarse, 2 * coarseRadius + 1, blurPlan.coarseSigma, border);
+    GrayscaleImage result = upsample(coarse, blurPlan.level, image.get_width(), image.get_height());
+
+    // 3. Compare a spread of rows against the exact blur.
+    if (report != nullptr) {
+        report->plan = blurPlan;
+        report->sampledRows = std::min(SAMPLED_ROWS, image.get_height());
+        report->maxError = 0;
+        long totalError = 0;
+        std::shared_ptr<const GaussianKernel> kernel = KernelCache::gaussian(kernelSize, sigma);
+        PooledBuffer<uint8_t> exact(image.get_width());
+        for (int s = 0; s < report->sampledRows; s++) {
+            int row = report->sampledRows == 1 ? 0 : (int) ((long) s * (image.get_height() - 1) / (report->sampledRows - 1));
+            exact_row(image, *kernel, border, row, exact.data());
+            const uint8_t* actual = result.row(row);
+            for (int j = 0; j < image.get_width(); j++) {
+                int error = std::abs(actual[j] - exact[j]);
+                report->maxError = std::max(report->maxError, error);
+                totalError += error;
+            }
+        }
+        long samples = (long) report->sampledRows * image.get_width();
+        report->meanError = samples > 0 ? (double) totalError / samples : 0;
+    }
+    return result;
+}
+
+GrayscaleImage ImagePyramid::downsample(const GrayscaleImage& image) {
+    int width = image.get_width();
+    int height = image.get_height();
+    GrayscaleImage result((width + 1) / 2, (height + 1) / 2);
+    if (width == 0 || height == 0) {
+        return result;
+    }
+    ScopedTimer timer("pyramid.downsample", (uint64_t) width * height, (uint64_t) width * height * 5 / 4);
+
+    TileExecutor::for_each_band(result.get_height(), 0, [&](const RowBand& band) {
+        // Vertical 1 4 6 4 1 sums over the full width, with two reflected columns
+        // on each side, then the same taps horizontally at every other column.
+        PooledBuffer<int> paddedSums(width + 4);
+        int* sums = paddedSums.data() + 2;
+        const int taps[] = { 1, 4, 6, 4, 1 };
+        for (int i = band.begin; i < band.end; i++) {
+            std::fill(sums, sums + width, 0);
+            for (int a = 0; a < 5; a++) {
+                const uint8_t* row = image.row(border_index(2 * i + a - 2, height, BORDER_REFLECT));
+                for (int j = 0; j < width; j++) {
+                    sums[j] += taps[a] * row[j];
+                }
+            }
+            FilterKernels::pad_sums(paddedSums.data(), width, 2, BORDER_REFLECT);
+
+            uint8_t* out = result.row(i);
+            const int* in = paddedSums.data();
+            for (int j = 0; j < result.get_width(); j++) {
+                const int* window = in + 2 * j;
+                int sum = window[0] + 4 * window[1] + 6 * window[2] + 4 * window[3] + window[4];
+                out[j] = static_cast<uint8_t>((sum + 128) >> 8);
+            }
+        }
+    });
+    return result;
+}
+
+GrayscaleImage ImagePyramid::upsample(const GrayscaleImage& image, int level, int width, int height) {
+    GrayscaleImage result(width, height);
+    if (width == 0 || height == 0 || image.get_width() == 0 || image.get_height() == 0) {
+        return result;
+    }
+    ScopedTimer timer("pyramid.upsample", (uint64_t) width * height, (uint64_t) width * height);
+
+    // 1. Source position of every output column. The last few level 0 pixels can
+    //    lie past the last sample of the level; they are extrapolated from the
+    //    last two samples rather than clamped, so the edges keep their slope.
+    const int one = 1 << BILINEAR_BITS;
+    const double scale = (double) (1 << level);
+    auto locate = [one, scale](int index, int sourceSize, int& first, int& second, int& weight) {
+        double position = index / scale;
+        first = std::min((int) position, std::max(sourceSize - 2, 0));
+        second = std::min(first + 1, sourceSize - 1);
+        weight = (int) std::floor((position - first) * one + 0.5);
+    };
+    std::vector<int> left(width), right(width), rightWeight(width);
+    for (int j = 0; j < width; j++) {
+        locate(j, image.get_width(), left[j], right[j], rightWeight[j]);
+    }
+
+    // 2. Interpolate each output row between its two source rows.
+    TileExecutor::for_each_band(height, 0, [&](const RowBand& band) {
+        PooledBuffer<int> top(width), bottom(width);
+        for (int i = band.begin; i < band.end; i++) {
+            int first, second, weight;
+            locate(i, image.get_height(), first, second, weight);
+            const uint8_t* upper = image.row(first);
+            const uint8_t* lower = image.row(second);
+            for (int j = 0; j < width; j++) {
+                top[j] = upper[left[j]] * (one - rightWeight[j]) + upper[right[j]] * rightWeight[j];
+                bottom[j] = lower[left[j]] * (one - rightWeight[j]) + lower[right[j]] * rightWeight[j];
+            }
+            uint8_t* out = result.row(i);
+            const int half = 1 << (2 * BILINEAR_BITS - 1);
+            for (int j = 0; j < width; j++) {
+                int value = (top[j] * (one - weight) + bottom[j] * weight + half) >> (2 * BILINEAR_BITS);
+                out[j] = static_cast<uint8_t>(value < 0 ? 0 : (value > 255 ? 255 : value));
+            }
+        }
+    });
+    return result;
+}
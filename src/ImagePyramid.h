@@ -0,0 +1,89 @@
+#ifndef IMAGE_PYRAMID_H
+#define IMAGE_PYRAMID_H
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "BorderMode.h"
+#include "GrayscaleImage.h"
+
+// How ImagePyramid::gaussian computes a blur.
+enum BlurPath {
+    BLUR_AUTO,      // Whichever the cost model estimates to be cheaper
+    BLUR_DIRECT,    // Filter::apply_gaussian_smoothing at full resolution
+    BLUR_PYRAMID    // Blur a downsampled level, then upsample
+};
+
+// Estimated cost of both paths for one blur, in multiply-adds per full-resolution pixel.
+struct BlurPlan {
+    BlurPath path;          // BLUR_DIRECT or BLUR_PYRAMID, never BLUR_AUTO
+    int level;              // Level the pyramid path blurs at; 0 if it cannot be used
+    double coarseSigma;     // Sigma of the blur at that level, in its own pixels
+    double directCost;
+    double pyramidCost;     // Includes building the levels that are not cached yet
+};
+
+// What a blur did and how far it is from the exact result. The direct path is
+// exact by construction; for the pyramid path, the exact blur of a sample of rows
+// (always including the first and last) is computed and compared.
+struct BlurReport {
+    BlurPlan plan;
+    int sampledRows;
+    int maxError;           // Largest |result - exact| over the sampled rows
+    double meanError;       // Mean |result - exact| over the sampled rows
+};
+
+// Gaussian pyramid over one image. Level 0 is the image itself; level n + 1 is
+// level n smoothed with a 5-tap binomial filter and halved in each direction
+// (rounding up). Levels are built on first use and kept, so repeated blurs of
+// the same image pay for each level once. Safe to use from several threads.
+class ImagePyramid {
+private:
+    // Level 0 never changes, so it is read without the lock. Only levels 1 and
+    // up live in the vector, which level() grows under the lock.
+    const std::unique_ptr<GrayscaleImage> base;
+    std::vector<std::unique_ptr<GrayscaleImage> > levels;
+    mutable std::mutex mutex;
+
+public:
+    explicit ImagePyramid(const GrayscaleImage& image);
+    explicit ImagePyramid(GrayscaleImage&& image);
+
+    ImagePyramid(const ImagePyramid&) = delete;
+    ImagePyramid& operator=(const ImagePyramid&) = delete;
+
+    // Returns level index, building it and any coarser-than-cached levels before
+    // it. Throws std::out_of_range past the level where the image is 1x1.
+    const GrayscaleImage& level(int index);
+
+    // Number of levels built so far, including level 0.
+    int get_cached_levels() const;
+
+    // Number of levels the image has, down to 1x1.
+    int get_level_count() const;
+
+    // Costs of both paths for a blur with the same arguments as
+    // Filter::apply_gaussian_smoothing, and the path BLUR_AUTO would take.
+    BlurPlan plan(int kernelSize, double sigma) const;
+
+    // Gaussian blur of level 0. BLUR_DIRECT gives exactly what
+    // Filter::apply_gaussian_smoothing gives; BLUR_PYRAMID approximates it and
+    // falls back to the direct path when no level is coarse enough to help.
+    // Away from the edges the pyramid path is typically within a level or two;
+    // within a few sigma of them it is less accurate, since the coarse grid
+    // cannot put the border exactly where the full-resolution one is.
+    // If report is given it is filled in, measuring the pyramid path's error
+    // at the cost of about kernelSize row passes per sampled row.
+    GrayscaleImage gaussian(int kernelSize, double sigma, BorderMode border = BORDER_ZERO,
+                            BlurPath path = BLUR_AUTO, BlurReport* report = nullptr);
+
+    // Halves image with the binomial filter, reading past the edges by reflection.
+    static GrayscaleImage downsample(const GrayscaleImage& image);
+
+    // Bilinear resize of a pyramid level back to a width x height level 0. Pixel j
+    // of level n lies at level 0 position j * 2^n, as downsample leaves it.
+    static GrayscaleImage upsample(const GrayscaleImage& image, int level, int width, int height);
+};
+
+#endif // IMAGE_PYRAMID_H
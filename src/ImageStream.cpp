@@ -0,0 +1,301 @@
+#include "ImageStream.h"
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+
+FileRowReader::FileRowReader(const std::string& filename)
+    : file(nullptr), filename(filename), width(0), height(0), nextRow(0) {
+    file = std::fopen(filename.c_str(), "rb");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+}
+
+FileRowReader::~FileRowReader() {
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+}
+
+// Records the dimensions once the header (if any) has been consumed.
+void FileRowReader::start(int w, int h) {
+    if (w <= 0 || h < 0) {
+        throw std::runtime_error("Invalid image dimensions in " + filename);
+    }
+    width = w;
+    height = h;
+    buffer.resize(w);
+}
+
+const uint8_t* FileRowReader::read_row(int i) {
+    if (i != nextRow || i >= height) {
+        throw std::runtime_error("Rows of " + filename + " must be read once each, in order");
+    }
+    if (std::fread(buffer.data(), 1, width, file) != (size_t) width) {
+        throw std::runtime_error("Unexpected end of " + filename);
+    }
+    nextRow++;
+    return buffer.data();
+}
+
+// Reads the next header token of a PGM file, skipping whitespace and comments.
+static int read_pgm_number(FILE* file, const std::string& filename) {
+    int c = std::fgetc(file);
+    while (c == '#' || std::isspace(c)) {
+        if (c == '#') {
+            while (c != '\n' && c != EOF) {
+                c = std::fgetc(file);
+            }
+        }
+        c = std::fgetc(file);
+    }
+    if (!std::isdigit(c)) {
+        throw std::runtime_error("Malformed PGM header in " + filename);
+    }
+    long value = 0;
+    while (std::isdigit(c)) {
+        value = value * 10 + (c - '0');
+        if (value > 1000000000L) {
+            throw std::runtime_error("Malformed PGM header in " + filename);
+        }
+        c = std::fgetc(file);
+    }
+    // Exactly one whitespace character separates the header from the pixels.
+    if (!std::isspace(c)) {
+        throw std::runtime_error("Malformed PGM header in " + filename);
+    }
+    return (int) value;
+}
+
+PgmReader::PgmReader(const std::string& filename) : FileRowReader(filename), maxValue(255) {
+    char magic[2];
+    if (std::fread(magic, 1, 2, file) != 2 || magic[0] != 'P' || magic[1] != '5') {
+        throw std::runtime_error(filename + " is not a binary PGM (P5) file");
+    }
+    int w = read_pgm_number(file, filename);
+    int h = read_pgm_number(file, filename);
+    maxValue = read_pgm_number(file, filename);
+    if (maxValue <= 0 || maxValue > 255) {
+        throw std::runtime_error("Only 8-bit PGM files are supported: " + filename);
+    }
+    for (int v = 0; v <= maxValue; v++) {
+        scaled[v] = static_cast<uint8_t>((v * 255 + maxValue / 2) / maxValue);
+    }
+    start(w, h);
+}
+
+const uint8_t* PgmReader::read_row(int i) {
+    const uint8_t* row = FileRowReader::read_row(i);
+    if (maxValue == 255) {
+        return row;
+    }
+    for (int j = 0; j < width; j++) {
+        if (buffer[j] > maxValue) {
+            throw std::runtime_error("Pixel value above the PGM maximum in " + filename);
+        }
+        buffer[j] = scaled[buffer[j]];
+    }
+    return buffer.data();
+}
+
+RawReader::RawReader(const std::string& filename, int width, int height, long headerBytes)
+    : FileRowReader(filename) {
+    if (headerBytes > 0 && std::fseek(file, headerBytes, SEEK_SET) != 0) {
+        throw std::runtime_error("Could not skip the header of " + filename);
+    }
+    start(width, height);
+}
+
+PgmWriter::PgmWriter(const std::string& filename, int width, int height)
+    : file(nullptr), filename(filename), width(width), height(height), nextRow(0) {
+    file = std::fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not create " + filename);
+    }
+    std::fprintf(file, "P5\n%d %d\n255\n", width, height);
+    if (height == 0) {
+        std::fclose(file);
+        file = nullptr;
+    }
+}
+
+PgmWriter::~PgmWriter() {
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+}
+
+void PgmWriter::write_row(int i, const uint8_t* row) {
+    if (file == nullptr || i != nextRow) {
+        throw std::runtime_error("Rows of " + filename + " must be written once each, in order");
+    }
+    std::fwrite(row, 1, width, file);
+    nextRow++;
+
+    // The last row completes the file.
+    if (nextRow == height) {
+        bool failed = std::ferror(file) != 0;
+        failed = std::fclose(file) != 0 || failed;
+        file = nullptr;
+        if (failed) {
+            throw std::runtime_error("Could not write " + filename);
+        }
+    }
+}
+
+// CRC-32 as used by PNG chunks, with its table built on first use.
+static uint32_t crc32_update(uint32_t crc, const uint8_t* data, size_t length) {
+    struct Table {
+        uint32_t entries[256];
+        Table() {
+            for (uint32_t n = 0; n < 256; n++) {
+                uint32_t c = n;
+                for (int k = 0; k < 8; k++) {
+                    c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+                }
+                entries[n] = c;
+            }
+        }
+    };
+    static const Table table;
+    for (size_t i = 0; i < length; i++) {
+        crc = table.entries[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+// Adler-32 as used by the zlib stream, taking the modulo once per 5552 bytes.
+static uint32_t adler32_update(uint32_t adler, const uint8_t* data, size_t length) {
+    const uint32_t base = 65521;
+    uint32_t a = adler & 0xFFFF;
+    uint32_t b = adler >> 16;
+    while (length > 0) {
+        size_t block = length < 5552 ? length : 5552;
+        length -= block;
+        for (size_t i = 0; i < block; i++) {
+            a += data[i];
+            b += a;
+        }
+        data += block;
+        a %= base;
+        b %= base;
+    }
+    return (b << 16) | a;
+}
+
+static void put_u32(std::vector<uint8_t>& out, uint32_t value) {
+    out.push_back(static_cast<uint8_t>(value >> 24));
+    out.push_back(static_cast<uint8_t>(value >> 16));
+    out.push_back(static_cast<uint8_t>(value >> 8));
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+PngStripWriter::PngStripWriter(const std::string& filename, int width, int height, int stripRows)
+    : file(nullptr), filename(filename), width(width), height(height), nextRow(0),
+      stripBytes((size_t) (stripRows > 0 ? stripRows : 1) * (width + 1)), adler(1), headerWritten(false) {
+    // PNG has no empty images: IHDR requires both dimensions to be at least 1.
+    if (width <= 0 || height <= 0) {
+        throw std::invalid_argument("PNG dimensions must be positive");
+    }
+    file = std::fopen(filename.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Could not create " + filename);
+    }
+    strip.reserve(stripBytes + width + 1);
+
+    // Signature and IHDR: 8-bit grayscale, no interlacing.
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    std::fwrite(signature, 1, sizeof(signature), file);
+    std::vector<uint8_t> header;
+    put_u32(header, (uint32_t) width);
+    put_u32(header, (uint32_t) height);
+    header.push_back(8);  // Bit depth
+    header.push_back(0);  // Grayscale
+    header.push_back(0);  // Deflate
+    header.push_back(0);  // Adaptive filtering
+    header.push_back(0);  // No interlace
+    write_chunk("IHDR", header.data(), header.size());
+}
+
+PngStripWriter::~PngStripWriter() {
+    if (file != nullptr) {
+        std::fclose(file);
+    }
+}
+
+void PngStripWriter::write_chunk(const char* type, const uint8_t* data, size_t length) {
+    uint8_t prefix[8];
+    prefix[0] = static_cast<uint8_t>(length >> 24);
+    prefix[1] = static_cast<uint8_t>(length >> 16);
+    prefix[2] = static_cast<uint8_t>(length >> 8);
+    prefix[3] = static_cast<uint8_t>(length);
+    std::memcpy(prefix + 4, type, 4);
+    uint32_t crc = crc32_update(0xFFFFFFFFu, prefix + 4, 4);
+    crc = crc32_update(crc, data, length) ^ 0xFFFFFFFFu;
+    uint8_t suffix[4] = { static_cast<uint8_t>(crc >> 24), static_cast<uint8_t>(crc >> 16),
+                          static_cast<uint8_t>(crc >> 8), static_cast<uint8_t>(crc) };
+    std::fwrite(prefix, 1, sizeof(prefix), file);
+    if (length > 0) {
+        std::fwrite(data, 1, length, file);
+    }
+    std::fwrite(suffix, 1, sizeof(suffix), file);
+}
+
+// Wraps the pending scanlines in stored deflate blocks and writes them as one IDAT
+// chunk. The last strip also closes the zlib stream and the file.
+void PngStripWriter::flush_strip(bool last) {
+    std::vector<uint8_t> chunk;
+    chunk.reserve(strip.size() + strip.size() / 65535 * 5 + 16);
+    if (!headerWritten) {
+        chunk.push_back(0x78);  // Deflate, 32K window
+        chunk.push_back(0x01);  // No preset dictionary, fastest
+        headerWritten = true;
+    }
+    size_t offset = 0;
+    do {
+        size_t length = strip.size() - offset < 65535 ? strip.size() - offset : 65535;
+        bool final = last && offset + length == strip.size();
+        chunk.push_back(final ? 1 : 0);
+        chunk.push_back(static_cast<uint8_t>(length));
+        chunk.push_back(static_cast<uint8_t>(length >> 8));
+        chunk.push_back(static_cast<uint8_t>(~length));
+        chunk.push_back(static_cast<uint8_t>(~length >> 8));
+        chunk.insert(chunk.end(), strip.begin() + offset, strip.begin() + offset + length);
+        offset += length;
+    } while (offset < strip.size());
+    if (last) {
+        put_u32(chunk, adler);
+    }
+    write_chunk("IDAT", chunk.data(), chunk.size());
+    strip.clear();
+
+    if (last) {
+        write_chunk("IEND", nullptr, 0);
+        bool failed = std::ferror(file) != 0;
+        failed = std::fclose(file) != 0 || failed;
+        file = nullptr;
+        if (failed) {
+            throw std::runtime_error("Could not write " + filename);
+        }
+    }
+}
+
+void PngStripWriter::write_row(int i, const uint8_t* row) {
+    if (file == nullptr || i != nextRow) {
+        throw std::runtime_error("Rows of " + filename + " must be written once each, in order");
+    }
+
+    // Each scanline is a filter type byte (0, none) followed by the pixels.
+    uint8_t filterType = 0;
+    strip.push_back(filterType);
+    strip.insert(strip.end(), row, row + width);
+    adler = adler32_update(adler, &filterType, 1);
+    adler = adler32_update(adler, row, width);
+    nextRow++;
+
+    if (nextRow == height) {
+        flush_strip(true);
+    } else if (strip.size() >= stripBytes) {
+        flush_strip(false);
+    }
+}
@@ -0,0 +1,112 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "FilterPipeline.h"
+
+// Streaming readers and writers for images too large to hold in memory. They
+// plug into FilterPipeline as RowSource / RowSink, so a chain of filters runs
+// over a file with memory bounded by the image width times the rows each stage
+// keeps (2 * radius + 1), e.g.
+//
+//     PgmReader input("strip.pgm");
+//     PngStripWriter output("strip_smoothed.png", input.get_width(), input.get_height());
+//     FilterPipeline().gaussian(41, 4).run(input, output);
+
+// Reads consecutive 8-bit rows from an open file, starting at a byte offset.
+class FileRowReader : public RowSource {
+protected:
+    FILE* file;
+    std::string filename;
+    int width, height;
+    int nextRow;
+    std::vector<uint8_t> buffer;
+
+    explicit FileRowReader(const std::string& filename);
+    void start(int w, int h);
+
+public:
+    virtual ~FileRowReader();
+    FileRowReader(const FileRowReader&) = delete;
+    FileRowReader& operator=(const FileRowReader&) = delete;
+
+    int get_width() const { return width; }
+    int get_height() const { return height; }
+
+    // Reads row i, which must be the next row of the file. Throws std::runtime_error
+    // when rows are requested out of order or the file ends early.
+    const uint8_t* read_row(int i);
+};
+
+// Binary PGM (P5) with a maximum value of at most 255. Rows come out scaled to
+// 0-255, so a file with a smaller maximum keeps its brightness.
+class PgmReader : public FileRowReader {
+private:
+    int maxValue;
+    uint8_t scaled[256];    // Pixel value -> value scaled to 0-255, when maxValue < 255
+
+public:
+    explicit PgmReader(const std::string& filename);
+
+    // As FileRowReader::read_row; also throws std::runtime_error for a pixel
+    // above the file's maximum value.
+    const uint8_t* read_row(int i);
+};
+
+// Headerless 8-bit pixels, width bytes per row, after headerBytes bytes of anything.
+class RawReader : public FileRowReader {
+public:
+    RawReader(const std::string& filename, int width, int height, long headerBytes = 0);
+};
+
+// Writes a binary PGM (P5) row by row; the file is complete after the last row.
+class PgmWriter : public RowSink {
+private:
+    FILE* file;
+    std::string filename;
+    int width, height;
+    int nextRow;
+
+public:
+    PgmWriter(const std::string& filename, int width, int height);
+    ~PgmWriter();
+    PgmWriter(const PgmWriter&) = delete;
+    PgmWriter& operator=(const PgmWriter&) = delete;
+
+    void write_row(int i, const uint8_t* row);
+};
+
+// Writes an 8-bit grayscale PNG in strips of rows, holding at most one strip in
+// memory. There is no streaming deflate encoder in the tree, so the pixel data is
+// stored in uncompressed deflate blocks: the file is a valid PNG about the size of
+// the raw pixels. Re-encode it with any PNG tool if the size matters.
+class PngStripWriter : public RowSink {
+private:
+    FILE* file;
+    std::string filename;
+    int width, height;
+    int nextRow;
+    size_t stripBytes;
+    std::vector<uint8_t> strip;    // Filtered scanlines waiting for the next IDAT chunk
+    uint32_t adler;                // Running Adler-32 of every scanline byte
+    bool headerWritten;            // Whether the zlib header has been emitted
+
+    void write_chunk(const char* type, const uint8_t* data, size_t length);
+    void flush_strip(bool last);
+
+public:
+    // stripRows is the number of rows collected before an IDAT chunk is written.
+    // Throws std::invalid_argument unless width and height are both positive.
+    PngStripWriter(const std::string& filename, int width, int height, int stripRows = 64);
+    ~PngStripWriter();
+    PngStripWriter(const PngStripWriter&) = delete;
+    PngStripWriter& operator=(const PngStripWriter&) = delete;
+
+    void write_row(int i, const uint8_t* row);
+};
+
+#endif // IMAGE_STREAM_H
@@ -0,0 +1,241 @@
+#include "IncrementalFilter.h"
+#include "Filter.h"
+#include "KernelCache.h"
+#include "TileExecutor.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <utility>
+
+IncrementalFilter::IncrementalFilter(const GrayscaleImage& image, int tileSize)
+    : image(image), filtered(image.get_width(), image.get_height()), tileSize(tileSize),
+      tileColumns(0), tileRows(0), staleCount(0), radiusX(0), radiusY(0), border(BORDER_ZERO) {
+    if (tileSize < 1) {
+        throw std::invalid_argument("The tile size must be at least 1.");
+    }
+    tileColumns = (image.get_width() + tileSize - 1) / tileSize;
+    tileRows = (image.get_height() + tileSize - 1) / tileSize;
+    staleTiles.assign((size_t) tileColumns * tileRows, 0);
+    apply = [](GrayscaleImage&) {};
+    invalidate();
+}
+
+IncrementalFilter& IncrementalFilter::set_filter(const std::function<void(GrayscaleImage&)>& fn,
+                                                 int haloX, int haloY, BorderMode mode) {
+    apply = fn;
+    radiusX = std::max(0, haloX);
+    radiusY = std::max(0, haloY);
+    border = mode;
+    invalidate();
+    return *this;
+}
+
+IncrementalFilter& IncrementalFilter::mean(int kernelSize, BorderMode border) {
+    int radius = (kernelSize - 1) / 2;
+    return set_filter([=](GrayscaleImage& target) {
+        Filter::apply_mean_filter(target, kernelSize, border);
+    }, radius, radius, border);
+}
+
+IncrementalFilter& IncrementalFilter::gaussian(int kernelSize, double sigma, BorderMode border) {
+    int radius = KernelCache::gaussian(kernelSize, sigma)->radius;
+    return set_filter([=](GrayscaleImage& target) {
+        Filter::apply_gaussian_smoothing(target, kernelSize, sigma, border);
+    }, radius, radius, border);
+}
+
+IncrementalFilter& IncrementalFilter::unsharp(int kernelSize, double amount, BorderMode border) {
+    // The unsharp filter reads the pixels its sigma 1 blur reads.
+    int radius = KernelCache::gaussian(kernelSize, 1.0)->radius;
+    return set_filter([=](GrayscaleImage& target) {
+        Filter::apply_unsharp_mask(target, kernelSize, amount, border);
+    }, radius, radius, border);
+}
+
+IncrementalFilter& IncrementalFilter::convolve(const ConvolutionKernel& kernel, BorderMode border) {
+    return set_filter([=](GrayscaleImage& target) {
+        Filter::convolve(target, kernel, border);
+    }, kernel.get_width() / 2, kernel.get_height() / 2, border);
+}
+
+// Marks the tiles overlapping output rows [top, bottom) and columns [left, right),
+// clipped to the image.
+void IncrementalFilter::mark_output(int top, int left, int bottom, int right) {
+    top = std::max(top, 0);
+    left = std::max(left, 0);
+    bottom = std::min(bottom, image.get_height());
+    right = std::min(right, image.get_width());
+    if (top >= bottom || left >= right) {
+        return;
+    }
+    for (int ty = top / tileSize; ty <= (bottom - 1) / tileSize; ty++) {
+        for (int tx = left / tileSize; tx <= (right - 1) / tileSize; tx++) {
+            uint8_t& stale = staleTiles[(size_t) ty * tileColumns + tx];
+            if (!stale) {
+                stale = 1;
+                staleCount++;
+            }
+        }
+    }
+}
+
+// Output ranges along one axis that read any of the edited [begin, end), for a
+// kernel reaching radius pixels each way. Replicated and reflected borders only
+// read pixels within radius of the output, as long as the radius stays below the
+// size; wrapped borders also reach the far side.
+static std::vector<std::pair<int, int> > affected_ranges(int begin, int end, int radius, int size,
+                                                         BorderMode border) {
+    std::vector<std::pair<int, int> > ranges;
+    if ((border == BORDER_WRAP || border == BORDER_REFLECT) && radius >= size) {
+        ranges.push_back(std::make_pair(0, size));
+        return ranges;
+    }
+    ranges.push_back(std::make_pair(begin - radius, end + radius));
+    if (border == BORDER_WRAP) {
+        ranges.push_back(std::make_pair(begin - radius - size, end + radius - size));
+        ranges.push_back(std::make_pair(begin - radius + size, end + radius + size));
+    }
+    return ranges;
+}
+
+// Clips rect to a width x height image; false if nothing is left.
+static bool clip(ImageRect& rect, int width, int height) {
+    int bottom = std::min(rect.top + rect.height, height);
+    int right = std::min(rect.left + rect.width, width);
+    rect.top = std::max(rect.top, 0);
+    rect.left = std::max(rect.left, 0);
+    rect.height = bottom - rect.top;
+    rect.width = right - rect.left;
+    return rect.height > 0 && rect.width > 0;
+}
+
+void IncrementalFilter::mark_dirty(const ImageRect& rect) {
+    ImageRect edited = rect;
+    if (!clip(edited, image.get_width(), image.get_height())) {
+        return;
+    }
+    std::vector<std::pair<int, int> > rows = affected_ranges(edited.top, edited.top + edited.height,
+                                                             radiusY, image.get_height(), border);
+    std::vector<std::pair<int, int> > columns = affected_ranges(edited.left, edited.left + edited.width,
+                                                                radiusX, image.get_width(), border);
+    for (size_t r = 0; r < rows.size(); r++) {
+        for (size_t c = 0; c < columns.size(); c++) {
+            mark_output(rows[r].first, columns[c].first, rows[r].second, columns[c].second);
+        }
+    }
+}
+
+ImageView IncrementalFilter::edit(const ImageRect& rect) {
+    ImageRect edited = rect;
+    if (!clip(edited, image.get_width(), image.get_height())) {
+        return image.view().sub(0, 0, 0, 0);
+    }
+    mark_dirty(edited);
+    return image.view().sub(edited.top, edited.left, edited.height, edited.width);
+}
+
+void IncrementalFilter::set_pixel(int row, int col, int value) {
+    if (row < 0 || row >= image.get_height() || col < 0 || col >= image.get_width()) {
+        return;
+    }
+    image.set_pixel(row, col, value);
+    ImageRect rect = { row, col, 1, 1 };
+    mark_dirty(rect);
+}
+
+void IncrementalFilter::paste(const GrayscaleImage& patch, int top, int left) {
+    ImageRect rect = { top, left, patch.get_height(), patch.get_width() };
+    if (!clip(rect, image.get_width(), image.get_height())) {
+        return;
+    }
+    for (int i = 0; i < rect.height; i++) {
+        std::memcpy(image.row(rect.top + i) + rect.left,
+                    patch.row(rect.top - top + i) + (rect.left - left), rect.width);
+    }
+    mark_dirty(rect);
+}
+
+void IncrementalFilter::invalidate() {
+    std::fill(staleTiles.begin(), staleTiles.end(), 1);
+    staleCount = (int) staleTiles.size();
+}
+
+// Copy of rect grown by radiusX columns and radiusY rows, where the growth past the
+// image edges reads what the filter itself would read there under border.
+static GrayscaleImage crop_with_halo(const GrayscaleImage& image, const ImageRect& rect,
+                                     int radiusX, int radiusY, BorderMode border) {
+    GrayscaleImage crop(rect.width + 2 * radiusX, rect.height + 2 * radiusY);
+    std::vector<int> columns(crop.get_width());
+    for (int b = 0; b < crop.get_width(); b++) {
+        columns[b] = border_index(rect.left - radiusX + b, image.get_width(), border);
+    }
+    for (int a = 0; a < crop.get_height(); a++) {
+        int mapped = border_index(rect.top - radiusY + a, image.get_height(), border);
+        if (mapped < 0) {
+            continue;   // The blank crop already reads as zeros
+        }
+        const uint8_t* in = image.row(mapped);
+        uint8_t* out = crop.row(a);
+        for (int b = 0; b < crop.get_width(); b++) {
+            out[b] = columns[b] < 0 ? 0 : in[columns[b]];
+        }
+    }
+    return crop;
+}
+
+const GrayscaleImage& IncrementalFilter::result() {
+    if (staleCount == 0) {
+        return filtered;
+    }
+    int width = image.get_width();
+    int height = image.get_height();
+    ScopedTimer timer("incremental.update");
+
+    // 1. Collect each tile row's runs of consecutive stale tiles as output rectangles.
+    std::vector<ImageRect> runs;
+    uint64_t cropPixels = 0;
+    for (int ty = 0; ty < tileRows; ty++) {
+        for (int tx = 0; tx < tileColumns; tx++) {
+            if (!staleTiles[(size_t) ty * tileColumns + tx]) {
+                continue;
+            }
+            int first = tx;
+            while (tx + 1 < tileColumns && staleTiles[(size_t) ty * tileColumns + tx + 1]) {
+                tx++;
+            }
+            ImageRect run;
+            run.top = ty * tileSize;
+            run.left = first * tileSize;
+            run.height = std::min(tileSize, height - run.top);
+            run.width = std::min((tx + 1) * tileSize, width) - run.left;
+            runs.push_back(run);
+            cropPixels += (uint64_t) (run.height + 2 * radiusY) * (run.width + 2 * radiusX);
+        }
+    }
+
+    // 2. When the crops would cover at least the whole frame, filter the whole
+    //    frame instead; otherwise filter every run's crop in parallel and copy its
+    //    interior out. Runs never overlap, so they write without synchronization.
+    if (cropPixels >= (uint64_t) width * height) {
+        filtered = image;
+        apply(filtered);
+        timer.set_pixels((uint64_t) width * height);
+    } else {
+        TileExecutor::for_each_task((int) runs.size(), [&](int index) {
+            const ImageRect& run = runs[index];
+            GrayscaleImage crop = crop_with_halo(image, run, radiusX, radiusY, border);
+            apply(crop);
+            for (int i = 0; i < run.height; i++) {
+                std::memcpy(filtered.row(run.top + i) + run.left, crop.row(radiusY + i) + radiusX, run.width);
+            }
+        });
+        timer.set_pixels(cropPixels);
+    }
+
+    // 3. Every tile is current again.
+    Trace::count("incremental.tiles_recomputed", staleCount);
+    std::fill(staleTiles.begin(), staleTiles.end(), 0);
+    staleCount = 0;
+    return filtered;
+}
@@ -0,0 +1,75 @@
+#ifndef INCREMENTAL_FILTER_H
+#define INCREMENTAL_FILTER_H
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+#include "BorderMode.h"
+#include "ConvolutionKernel.h"
+#include "GrayscaleImage.h"
+
+// Keeps a filtered copy of an image up to date while the image is edited. The
+// output is split into square tiles; editing a region only marks the tiles whose
+// pixels read it, i.e. the region grown by the kernel radius (and, with wrapped
+// borders, its images on the far side), and result() recomputes just those.
+// Each run of stale tiles is filtered from a crop of the source with a halo of
+// the kernel radius, filled in from the image's own border rule, so every pixel
+// comes out exactly as the full-frame Filter function gives it.
+//
+// The filter is chosen with mean(), gaussian(), unsharp() or convolve(); until
+// then the output is a plain copy. Not safe for concurrent use.
+class IncrementalFilter {
+private:
+    GrayscaleImage image;
+    GrayscaleImage filtered;
+    int tileSize, tileColumns, tileRows;
+    std::vector<uint8_t> staleTiles;       // One flag per tile, row-major
+    int staleCount;
+
+    std::function<void(GrayscaleImage&)> apply;  // The Filter call, on a whole image
+    int radiusX, radiusY;                  // Columns and rows of halo it reads
+    BorderMode border;
+
+    IncrementalFilter& set_filter(const std::function<void(GrayscaleImage&)>& fn,
+                                  int haloX, int haloY, BorderMode mode);
+    void mark_output(int top, int left, int bottom, int right);
+
+public:
+    static const int DEFAULT_TILE_SIZE = 64;
+
+    // Takes a copy of image; the filtered output starts out stale. Throws
+    // std::invalid_argument for a tile size below 1.
+    explicit IncrementalFilter(const GrayscaleImage& image, int tileSize = DEFAULT_TILE_SIZE);
+
+    // Choose the filter, with the same arguments and defaults as the Filter
+    // functions, and mark every tile stale.
+    IncrementalFilter& mean(int kernelSize = 3, BorderMode border = BORDER_ZERO);
+    IncrementalFilter& gaussian(int kernelSize = 3, double sigma = 1.0, BorderMode border = BORDER_ZERO);
+    IncrementalFilter& unsharp(int kernelSize = 3, double amount = 1.5, BorderMode border = BORDER_ZERO);
+    IncrementalFilter& convolve(const ConvolutionKernel& kernel, BorderMode border = BORDER_ZERO);
+
+    // The image being filtered.
+    const GrayscaleImage& get_source() const { return image; }
+
+    // Edits. Each marks the tiles it affects; set_pixel and paste clip to the image.
+    void set_pixel(int row, int col, int value);
+    void paste(const GrayscaleImage& patch, int top, int left);
+
+    // Marks rect as edited and returns a view of it to write into before the next
+    // result(). rect is clipped to the image.
+    ImageView edit(const ImageRect& rect);
+    void mark_dirty(const ImageRect& rect);
+
+    // Marks every tile stale, e.g. after Filter::set_precision.
+    void invalidate();
+
+    // The filtered image, recomputing the stale tiles first.
+    const GrayscaleImage& result();
+
+    int get_tile_size() const { return tileSize; }
+    int get_tile_count() const { return tileColumns * tileRows; }
+    int get_stale_tile_count() const { return staleCount; }
+};
+
+#endif // INCREMENTAL_FILTER_H
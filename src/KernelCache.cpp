@@ -0,0 +1,94 @@
+#include "KernelCache.h"
+#include <cmath>
+#include <map>
+#include <math.h>
+#include <mutex>
+#include <utility>
+
+// Upper bound on distinct (kernelSize, sigma) pairs kept alive at once.
+static const size_t MAX_CACHED_KERNELS = 64;
+
+static std::mutex cacheMutex;
+static std::map<std::pair<int, double>, std::shared_ptr<const GaussianKernel> > cache;
+
+// Builds both the separable and the 2D weights for a Gaussian kernel.
+static std::shared_ptr<const GaussianKernel> build_gaussian(int kernelSize, double sigma) {
+    std::shared_ptr<GaussianKernel> kernel = std::make_shared<GaussianKernel>();
+    int countOfRows = (kernelSize - 1) / 2;
+    int size = 2 * countOfRows + 1;
+    kernel->size = size;
+    kernel->radius = countOfRows;
+    kernel->sigma = sigma;
+
+    // 1. The 2D weights are computed exactly as the original per-call kernel was,
+    //    in the same order, so the fallback path reproduces it bit for bit.
+    kernel->weights2D.resize((size_t) size * size);
+    double sum = 0;
+    for (int i = -countOfRows; i <= countOfRows; i++) {
+        for (int j = -countOfRows; j <= countOfRows; j++) {
+            double coefficient = 1.0 / (2 * M_PI * sigma * sigma);
+            double exponent = -(i * i + j * j) / (2 * sigma * sigma);
+            double kernelValue = coefficient * std::exp(exponent);
+            kernel->weights2D[(size_t) (i + countOfRows) * size + (j + countOfRows)] = kernelValue;
+            sum += kernelValue;
+        }
+    }
+    for (size_t i = 0; i < kernel->weights2D.size(); i++) {
+        kernel->weights2D[i] /= sum;
+    }
+
+    // 2. The 2D Gaussian is the outer product of the 1D one, so the separable
+    //    weights only need the 1D exponent, normalized on their own.
+    kernel->weights.resize(size);
+    double sum1D = 0;
+    for (int i = -countOfRows; i <= countOfRows; i++) {
+        double kernelValue = std::exp(-(i * i) / (2 * sigma * sigma));
+        kernel->weights[i + countOfRows] = kernelValue;
+        sum1D += kernelValue;
+    }
+    for (int i = 0; i < size; i++) {
+        kernel->weights[i] /= sum1D;
+    }
+
+    // 3. Quantize the 1D weights, handing the rounding leftover to the center tap
+    //    so they still sum to one, then bound the error of both fixed-point passes
+    //    against the 2D weights: 255 for the largest pixel times the weight error,
+    //    plus the rounding of the horizontal results to Q6.
+    int one = 1 << GAUSSIAN_WEIGHT_BITS;
+    kernel->fixedWeights.resize(size);
+    int fixedSum = 0;
+    for (int i = 0; i < size; i++) {
+        kernel->fixedWeights[i] = (int) std::floor(kernel->weights[i] * one + 0.5);
+        fixedSum += kernel->fixedWeights[i];
+    }
+    kernel->fixedWeights[countOfRows] += one - fixedSum;
+    double weightError = 0;
+    for (int i = 0; i < size; i++) {
+        for (int j = 0; j < size; j++) {
+            double product = (double) kernel->fixedWeights[i] * kernel->fixedWeights[j] / ((double) one * one);
+            weightError += std::fabs(product - kernel->weights2D[(size_t) i * size + j]);
+        }
+    }
+    kernel->fixedPointError = 255 * weightError + 0.5 / (1 << GAUSSIAN_HORIZONTAL_BITS);
+    return kernel;
+}
+
+std::shared_ptr<const GaussianKernel> KernelCache::gaussian(int kernelSize, double sigma) {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    std::pair<int, double> key(kernelSize, sigma);
+    std::map<std::pair<int, double>, std::shared_ptr<const GaussianKernel> >::iterator it = cache.find(key);
+    if (it != cache.end()) {
+        return it->second;
+    }
+    if (cache.size() >= MAX_CACHED_KERNELS) {
+        cache.clear();
+    }
+    std::shared_ptr<const GaussianKernel> kernel = build_gaussian(kernelSize, sigma);
+    cache[key] = kernel;
+    return kernel;
+}
+
+void KernelCache::clear() {
+    std::lock_guard<std::mutex> lock(cacheMutex);
+    cache.clear();
+}
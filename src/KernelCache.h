@@ -0,0 +1,45 @@
+#ifndef KERNEL_CACHE_H
+#define KERNEL_CACHE_H
+
+#include <memory>
+#include <vector>
+
+// Fractional bits of the fixed-point Gaussian weights (Q14), and of the
+// horizontal results the vertical pass reads (Q6). A pixel times a weight and
+// the vertical Q20 sums both fit comfortably in 32 bits.
+static const int GAUSSIAN_WEIGHT_BITS = 14;
+static const int GAUSSIAN_HORIZONTAL_BITS = 6;
+
+// Normalized Gaussian weights for one (kernelSize, sigma) pair.
+struct GaussianKernel {
+    int size;      // Number of taps per axis, 2 * radius + 1
+    int radius;
+    double sigma;
+
+    // 1D weights used by the separable horizontal and vertical passes.
+    std::vector<double> weights;
+
+    // size x size weights of the original 2D formulation, row-major. The separable
+    // passes fall back to these when truncation could differ from the 2D result.
+    std::vector<double> weights2D;
+
+    // The 1D weights quantized to Q14, summing to exactly 1 << GAUSSIAN_WEIGHT_BITS.
+    // Each one fits in 16 bits.
+    std::vector<int> fixedWeights;
+
+    // Worst-case distance, over every possible image, between the fixed-point sum
+    // and the 2D double sum before truncation. While it is below 1 the fixed-point
+    // output is never more than one gray level from the exact one.
+    double fixedPointError;
+};
+
+class KernelCache {
+public:
+    // Returns the kernel for (kernelSize, sigma), building it on first use.
+    static std::shared_ptr<const GaussianKernel> gaussian(int kernelSize, double sigma);
+
+    // Drops every cached kernel.
+    static void clear();
+};
+
+#endif // KERNEL_CACHE_H
@@ -0,0 +1,24 @@
+#ifndef LEGACY_MIRROR_H
+#define LEGACY_MIRROR_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Brings count entries of an int mirror, as the compatibility getters of
+// GrayscaleImage and SecretImage hand out, up to date with the 8-bit values.
+// The caller holds the owner's mirror lock.
+//
+// Only entries that differ are written. While nobody modifies the image a
+// refresh therefore writes nothing, and threads still reading a pointer an
+// earlier call returned never race with it. Once the image has been modified,
+// the next refresh does write, and races with any thread still reading the
+// mirror through an old pointer.
+inline void refresh_int_mirror(int* mirror, const uint8_t* values, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (mirror[i] != values[i]) {
+            mirror[i] = values[i];
+        }
+    }
+}
+
+#endif // LEGACY_MIRROR_H
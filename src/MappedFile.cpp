@@ -0,0 +1,37 @@
+#include "MappedFile.h"
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile(const std::string& filename) : bytes(nullptr), length(0) {
+    int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Could not open " + filename);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Could not stat " + filename);
+    }
+    length = (size_t) info.st_size;
+
+    // An empty file has nothing to map.
+    if (length > 0) {
+        void* mapped = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Could not map " + filename);
+        }
+        bytes = static_cast<uint8_t*>(mapped);
+    }
+    // The mapping stays valid after the descriptor is closed.
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (bytes != nullptr) {
+        munmap(bytes, length);
+    }
+}
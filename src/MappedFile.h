@@ -0,0 +1,27 @@
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Read-only view of a whole file through mmap. The mapping is private and
+// copy-on-write, so callers may modify the bytes without touching the file.
+class MappedFile {
+private:
+    uint8_t* bytes;
+    size_t length;
+
+public:
+    // Maps the file; throws std::runtime_error if it cannot be opened or mapped.
+    explicit MappedFile(const std::string& filename);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    uint8_t* data() const { return bytes; }
+    size_t size() const { return length; }
+};
+
+#endif // MAPPED_FILE_H
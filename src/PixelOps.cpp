@@ -0,0 +1,148 @@
+#include "PixelOps.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#define PIXEL_OPS_X86 1
+#include <immintrin.h>
+#endif
+
+// Scalar fallbacks, also used for the tails the vector loops leave over.
+static void add_scalar(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int sum = a[i] + b[i];
+        out[i] = static_cast<uint8_t>(sum > 255 ? 255 : sum);
+    }
+}
+
+static void subtract_scalar(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        int difference = a[i] - b[i];
+        out[i] = static_cast<uint8_t>(difference < 0 ? 0 : difference);
+    }
+}
+
+static size_t mismatch_scalar(const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t i = 0;
+    while (i < count && a[i] == b[i]) {
+        i++;
+    }
+    return i;
+}
+
+#ifdef PIXEL_OPS_X86
+
+// SSE2 kernels, 16 pixels per step.
+static void add_sse2(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_adds_epu8(x, y));
+    }
+    add_scalar(a + i, b + i, out + i, count - i);
+}
+
+static void subtract_sse2(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), _mm_subs_epu8(x, y));
+    }
+    subtract_scalar(a + i, b + i, out + i, count - i);
+}
+
+static size_t mismatch_sse2(const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        unsigned int equal = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(x, y));
+        if (equal != 0xFFFFu) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    return i + mismatch_scalar(a + i, b + i, count - i);
+}
+
+// AVX2 kernels, 32 pixels per step; only called when the CPU reports AVX2.
+__attribute__((target("avx2")))
+static void add_avx2(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_adds_epu8(x, y));
+    }
+    add_sse2(a + i, b + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static void subtract_avx2(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_subs_epu8(x, y));
+    }
+    subtract_sse2(a + i, b + i, out + i, count - i);
+}
+
+__attribute__((target("avx2")))
+static size_t mismatch_avx2(const uint8_t* a, const uint8_t* b, size_t count) {
+    size_t i = 0;
+    for (; i + 32 <= count; i += 32) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i));
+        unsigned int equal = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y));
+        if (equal != 0xFFFFFFFFu) {
+            return i + __builtin_ctz(~equal);
+        }
+    }
+    return i + mismatch_sse2(a + i, b + i, count - i);
+}
+
+#endif // PIXEL_OPS_X86
+
+// Kernels picked for this CPU, resolved once on first use.
+struct PixelKernels {
+    void (*add)(const uint8_t*, const uint8_t*, uint8_t*, size_t);
+    void (*subtract)(const uint8_t*, const uint8_t*, uint8_t*, size_t);
+    size_t (*mismatch)(const uint8_t*, const uint8_t*, size_t);
+    const char* name;
+};
+
+static PixelKernels select_kernels() {
+#ifdef PIXEL_OPS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        PixelKernels kernels = { add_avx2, subtract_avx2, mismatch_avx2, "avx2" };
+        return kernels;
+    }
+    PixelKernels kernels = { add_sse2, subtract_sse2, mismatch_sse2, "sse2" };
+    return kernels;
+#else
+    PixelKernels kernels = { add_scalar, subtract_scalar, mismatch_scalar, "scalar" };
+    return kernels;
+#endif
+}
+
+static const PixelKernels& kernels() {
+    static const PixelKernels selected = select_kernels();
+    return selected;
+}
+
+void PixelOps::add_saturate(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    kernels().add(a, b, out, count);
+}
+
+void PixelOps::subtract_saturate(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count) {
+    kernels().subtract(a, b, out, count);
+}
+
+size_t PixelOps::first_mismatch(const uint8_t* a, const uint8_t* b, size_t count) {
+    return kernels().mismatch(a, b, count);
+}
+
+const char* PixelOps::instruction_set() {
+    return kernels().name;
+}
@@ -0,0 +1,24 @@
+#ifndef PIXEL_OPS_H
+#define PIXEL_OPS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized kernels over runs of 8-bit pixels. The widest instruction set the
+// CPU supports (AVX2, then SSE2) is picked at runtime, with a scalar fallback.
+class PixelOps {
+public:
+    // out[i] = min(a[i] + b[i], 255)
+    static void add_saturate(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count);
+
+    // out[i] = max(a[i] - b[i], 0)
+    static void subtract_saturate(const uint8_t* a, const uint8_t* b, uint8_t* out, size_t count);
+
+    // Index of the first i where a[i] != b[i], or count if the runs are equal.
+    static size_t first_mismatch(const uint8_t* a, const uint8_t* b, size_t count);
+
+    // Name of the instruction set in use: "avx2", "sse2" or "scalar".
+    static const char* instruction_set();
+};
+
+#endif // PIXEL_OPS_H
@@ -0,0 +1,73 @@
+#include "ReplacementFile.h"
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <random>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char ReplacementFile::TEMPORARY_SUFFIX[] = ".tmp";
+
+// Attempts at a free temporary name before giving up.
+static const int MAX_NAME_ATTEMPTS = 100;
+
+// Six random characters for a temporary name, as mkstemp would pick.
+static std::string random_suffix() {
+    static const char letters[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789";
+    std::random_device device;
+    std::string suffix(6, ' ');
+    for (size_t i = 0; i < suffix.size(); i++) {
+        suffix[i] = letters[device() % (sizeof(letters) - 1)];
+    }
+    return suffix;
+}
+
+ReplacementFile::ReplacementFile(const std::string& path) : target(path), committed(false) {
+    // 1. Replace what a symlink points at, not the link itself.
+    struct stat info;
+    if (lstat(path.c_str(), &info) == 0 && S_ISLNK(info.st_mode)) {
+        char resolved[PATH_MAX];
+        if (realpath(path.c_str(), resolved) != nullptr) {
+            target = resolved;
+        }
+    }
+
+    // 2. O_EXCL claims a random name no other thread or process is using, retrying
+    //    on a clash, and the kernel applies the process umask to 0666 as it would
+    //    for any new file. The umask is never read, since that means setting it.
+    int fd = -1;
+    for (int attempt = 0; attempt < MAX_NAME_ATTEMPTS && fd < 0; attempt++) {
+        temporary = target + TEMPORARY_SUFFIX + random_suffix();
+        fd = open(temporary.c_str(), O_CREAT | O_EXCL | O_WRONLY, 0666);
+        if (fd < 0 && errno != EEXIST) {
+            break;
+        }
+    }
+    if (fd < 0) {
+        throw std::runtime_error("Could not create a temporary file for " + path);
+    }
+
+    // 3. An existing target passes its own mode on.
+    if (stat(target.c_str(), &info) == 0 && fchmod(fd, info.st_mode & 07777) != 0) {
+        close(fd);
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Could not set the mode of a temporary file for " + path);
+    }
+    close(fd);
+}
+
+ReplacementFile::~ReplacementFile() {
+    if (!committed) {
+        std::remove(temporary.c_str());
+    }
+}
+
+void ReplacementFile::commit() {
+    if (std::rename(temporary.c_str(), target.c_str()) != 0) {
+        throw std::runtime_error("Could not write " + target);
+    }
+    committed = true;
+}
@@ -0,0 +1,39 @@
+#ifndef REPLACEMENT_FILE_H
+#define REPLACEMENT_FILE_H
+
+#include <string>
+
+// A temporary file, created under a random name next to a target file, that is
+// renamed over the target once it has been written. Readers of the target,
+// mappings of it included, keep the old contents until they let go of them, and
+// a failed or abandoned write leaves the target untouched.
+class ReplacementFile {
+private:
+    std::string target;      // The file commit() replaces, with symlinks resolved
+    std::string temporary;
+    bool committed;
+
+public:
+    // Temporary files are named <target>.tmpXXXXXX.
+    static const char TEMPORARY_SUFFIX[];
+
+    // Creates the temporary file with the target's permission bits, or with 0666
+    // less the umask if there is no target yet. Throws std::runtime_error if the
+    // file cannot be created.
+    explicit ReplacementFile(const std::string& path);
+
+    // Removes the temporary file unless it was committed.
+    ~ReplacementFile();
+
+    ReplacementFile(const ReplacementFile&) = delete;
+    ReplacementFile& operator=(const ReplacementFile&) = delete;
+
+    // Path to write the new contents to.
+    const std::string& path() const { return temporary; }
+
+    // Renames the temporary file over the target; throws std::runtime_error if
+    // that fails, leaving the target as it was.
+    void commit();
+};
+
+#endif // REPLACEMENT_FILE_H
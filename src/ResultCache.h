@@ -0,0 +1,98 @@
+#ifndef RESULT_CACHE_H
+#define RESULT_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "BorderMode.h"
+#include "Crypto.h"
+#include "GrayscaleImage.h"
+
+// Counters of the result cache since start or reset_stats().
+struct ResultCacheStats {
+    uint64_t memoryHits;
+    uint64_t diskHits;
+    uint64_t misses;
+    uint64_t stores;
+    uint64_t evictions;      // Entries dropped from either tier to stay under its limit
+    size_t memoryBytes;      // Pixels held by the memory tier
+    size_t diskBytes;        // Size of the files in the disk tier
+
+    double hit_rate() const {
+        uint64_t lookups = memoryHits + diskHits + misses;
+        return lookups > 0 ? (double) (memoryHits + diskHits) / lookups : 0.0;
+    }
+};
+
+// Optional process-wide cache of operation results, keyed by a hash of the input
+// pixels, the operation and its parameters (including the border mode and, for
+// the Gaussian and unsharp filters, Filter's precision). The wrappers below take
+// the same arguments as the Filter, GrayscaleImage and Crypto calls they stand in
+// for and give the same results; on a hit the work is skipped.
+//
+// Results live in a memory tier, evicted least recently used first once its
+// byte limit is reached, and, if a directory is set, in a disk tier with its
+// own limit that survives the process, for re-run jobs. Disk entries carry a
+// checksum; a damaged one is deleted and counted as a miss. Keys are 64-bit
+// hashes that fully mix every input word, so two different inputs collide only
+// by chance, with odds around n^2 / 2^65 for n cached entries; a collision would
+// return a wrong result.
+//
+// The cache is off unless set_enabled(true) is called or the CLEARVISION_CACHE
+// environment variable is set: "1" enables the memory tier, any other value is
+// also taken as the disk tier's directory. While off, every wrapper calls
+// straight through. Safe to use from several threads.
+class ResultCache {
+public:
+    static void set_enabled(bool on);
+    static bool is_enabled();
+
+    // Byte limits of the two tiers; 256 MiB of memory and 1 GiB of disk by default.
+    // Lowering a limit evicts entries right away.
+    static void set_memory_limit(size_t bytes);
+    static void set_disk_limit(size_t bytes);
+
+    // Directory for the disk tier, created if missing; an empty string turns the
+    // tier off. Entries already in it are picked up, oldest first in line for
+    // eviction, and temporary entry files over an hour old, left by a writer that
+    // died, are removed. Returns false if the directory cannot be used.
+    static bool set_disk_directory(const std::string& directory);
+
+    // Cached stand-ins for the Filter functions, with the same defaults.
+    static void apply_mean_filter(GrayscaleImage& image, int kernelSize = 3, BorderMode border = BORDER_ZERO);
+    static void apply_gaussian_smoothing(GrayscaleImage& image, int kernelSize = 3, double sigma = 1.0,
+                                         BorderMode border = BORDER_ZERO);
+    static void apply_unsharp_mask(GrayscaleImage& image, int kernelSize = 3, double amount = 1.5,
+                                   BorderMode border = BORDER_ZERO);
+
+    // Cached image + other and image - other.
+    static GrayscaleImage add(const GrayscaleImage& image, const GrayscaleImage& other);
+    static GrayscaleImage subtract(const GrayscaleImage& image, const GrayscaleImage& other);
+
+    // Cached Crypto::embed_LSBits and Crypto::embed_LSB_bits: image is left with
+    // the message embedded, as those leave it.
+    static SecretImage embed_LSBits(GrayscaleImage& image, const std::vector<int>& LSB_array);
+    static SecretImage embed_LSB_bits(GrayscaleImage& image, const BitBuffer& bits);
+
+    // Building blocks for caching other operations. hash_image covers the size
+    // and the visible pixels; make_key combines the operation's name, the hashes
+    // of its inputs and its parameters into a key.
+    static uint64_t hash_image(const GrayscaleImage& image);
+    static uint64_t hash_bytes(const void* data, size_t size, uint64_t seed = 0);
+    static uint64_t make_key(const std::string& operation, const std::vector<uint64_t>& inputs,
+                             const std::vector<double>& params);
+
+    // Copies the cached result for key into result, returning false on a miss.
+    static bool lookup(uint64_t key, GrayscaleImage& result);
+    static void store(uint64_t key, const GrayscaleImage& result);
+
+    static ResultCacheStats stats();
+    static void reset_stats();
+
+    // Empties the memory tier, and the disk tier too if withDisk is set.
+    static void clear(bool withDisk = false);
+};
+
+#endif // RESULT_CACHE_H
@@ -1,176 +1,629 @@
 #include "SecretImage.h"
+#include "BufferPool.h"
+#include "ContentHash.h"
+#include "LegacyMirror.h"
+#include "MappedFile.h"
+#include "ReplacementFile.h"
+#include "TileExecutor.h"
+#include "Trace.h"
+#include <algorithm>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include <vector>
 
 
-// Constructor: split image into upper and lower triangular arrays
-SecretImage::SecretImage(const GrayscaleImage& image) {
-    // 1. Dynamically allocate the memory for the upper and lower triangular matrices.
+// Header of the binary format, followed by the upper and then the lower array.
+// The format is little-endian: the header is copied to and from the file as it
+// sits in memory, and the checksum reads the payload as little-endian words, so
+// only little-endian hosts are supported (checked below). The header is padded to
+// 64 bytes so the payload starts cache-line aligned in the mapping.
+struct SecretImageHeader {
+    char magic[4];          // "CVSI"
+    uint32_t version;       // BINARY_VERSION
+    uint32_t width;
+    uint32_t height;
+    uint64_t checksum;      // payload_checksum() over both arrays
+    uint64_t upperSize;
+    uint64_t lowerSize;
+    uint8_t reserved[24];   // Zero
+};
 
+static_assert(sizeof(SecretImageHeader) == 64, "SecretImageHeader must stay 64 bytes");
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__, "The binary secret image format is little-endian only");
 
-    width = image.get_width();
-    height = image.get_height();
-    int upperSize = (height + 1 ) * height/2 ;
-    int lowerSize = (height - 1) * height/2 ;
-    upper_triangular = new int[upperSize];
-    lower_triangular = new int[lowerSize];
-    for(int i = 0; i < upperSize; i++) {
-        upper_triangular[i] = 0;
-    }
-    for(int i = 0; i < lowerSize; i++) {
-        lower_triangular[i] = 0;
-    }
-
-    // 2. Fill both matrices with the pixels from the GrayscaleImage.
-    int counter = 0;
-    for(int i = 0; i < height; i++) {
-        for(int j = i; j < width; j++) {
-            upper_triangular[counter] = image.get_pixel(i, j);
-            counter += 1;
+static const char BINARY_MAGIC[4] = { 'C', 'V', 'S', 'I' };
+// Version 2 replaced the FNV-1a checksum of version 1 with content_hash().
+static const uint32_t BINARY_VERSION = 2;
+
+// Checksum of the upper and then the lower array.
+static uint64_t payload_checksum(const uint8_t* upper, size_t upperSize, const uint8_t* lower, size_t lowerSize) {
+    return content_hash(lower, lowerSize, content_hash(upper, upperSize));
+}
+
+// Bytes of text parsed per task, and values formatted per task when saving.
+static const size_t TEXT_PARSE_CHUNK = 1 << 20;
+static const size_t TEXT_FORMAT_CHUNK = 1 << 18;
+
+// Whitespace as operator>> skips it in the "C" locale.
+static inline bool is_space(char c) {
+    return c == ' ' || (c >= '\t' && c <= '\r');
+}
+
+// Parses the integer starting at p, after any whitespace, the way from_chars
+// would: an optional sign and decimal digits, independent of the locale.
+// Advances p past it and returns true; otherwise, or if it does not fit an int,
+// leaves p at the end of the text, or at the start of whatever is there
+// instead, and returns false.
+static inline bool parse_int(const char*& p, const char* end, int& value) {
+    while (p < end && is_space(*p)) {
+        p++;
+    }
+    if (p == end) {
+        return false;
+    }
+    const char* token = p;
+    bool negative = *p == '-';
+    if (*p == '-' || *p == '+') {
+        p++;
+    }
+    const char* digits = p;
+    unsigned magnitude = 0;
+    while (p < end && (unsigned) (*p - '0') < 10) {
+        unsigned digit = (unsigned) (*p - '0');
+        if (magnitude > ((unsigned) INT_MAX - digit) / 10) {
+            p = token;
+            return false;
+        }
+        magnitude = magnitude * 10 + digit;
+        p++;
+    }
+    if (p == digits || (p < end && !is_space(*p))) {
+        p = token;
+        return false;
+    }
+    value = negative ? -(int) magnitude : (int) magnitude;
+    return true;
+}
+
+// Parses the integer of at most three digits at p, the kind save_text writes,
+// if p[length] after it is whitespace and it is at most 255. The digits are
+// combined with masks rather than a branch per digit, which mispredicts on mixed
+// lengths. Needs four readable bytes at p.
+static inline bool parse_short(const char* p, uint8_t& value, int& length) {
+    unsigned a = (unsigned) (p[0] - '0');
+    unsigned b = (unsigned) (p[1] - '0');
+    unsigned c = (unsigned) (p[2] - '0');
+    unsigned hasB = (unsigned) (b < 10);
+    unsigned hasC = hasB & (unsigned) (c < 10);
+    unsigned twoDigits = a + ((0u - hasB) & (a * 9 + b));
+    unsigned number = twoDigits + ((0u - hasC) & (twoDigits * 9 + c));
+    length = 1 + (int) (hasB + hasC);
+    value = static_cast<uint8_t>(number);
+    return (a < 10) & is_space(p[length]) & (number <= 255);
+}
+
+// Whether a parsed value fits the 8-bit arrays.
+static inline bool is_pixel_value(int value) {
+    return value >= 0 && value <= 255;
+}
+
+// Bit j set where p[j] is whitespace, for j < 64. The flags are worked out a
+// byte each in a loop that vectorizes, then each 8 of them gathered into 8 bits
+// by one multiply.
+static inline uint64_t whitespace_mask(const char* p) {
+    uint8_t flags[64];
+    for (int j = 0; j < 64; j++) {
+        uint8_t c = (uint8_t) p[j];
+        flags[j] = (uint8_t) ((c == ' ') | ((uint8_t) (c - '\t') <= '\r' - '\t'));
+    }
+    uint64_t mask = 0;
+    for (int k = 0; k < 8; k++) {
+        uint64_t word;
+        std::memcpy(&word, flags + 8 * k, 8);
+        mask |= ((word * 0x0102040810204080ULL) >> 56) << (8 * k);
+    }
+    return mask;
+}
+
+// Parses the integers of [p, end) into out, stopping at the first thing that is
+// not one or is outside 0-255; returns where it stopped, which is end if all of
+// it parsed. p must
+// start at whitespace or at the start of a number.
+//
+// The text goes in 64-byte blocks: a bitmask of the block's whitespace gives the
+// start of every number in it, so consecutive numbers are found and parsed
+// independently of each other rather than each waiting on the length of the
+// one before. Numbers the short path does not take go through parse_int.
+static const char* parse_values(const char* p, const char* end, uint8_t*& out) {
+    const char* next = p;           // First byte not yet consumed
+    uint64_t spaceBefore = 1;
+    for (; end - p >= 64 + 4; p += 64) {
+        uint64_t spaces = whitespace_mask(p);
+        uint64_t starts = ~spaces & ((spaces << 1) | spaceBefore);
+        spaceBefore = spaces >> 63;
+        while (starts != 0) {
+            const char* q = p + __builtin_ctzll(starts);
+            starts &= starts - 1;
+            uint8_t value;
+            int length;
+            if (parse_short(q, value, length)) {
+                *out++ = value;
+                next = q + length;
+                continue;
+            }
+            const char* token = q;
+            int wide;
+            if (!parse_int(q, end, wide) || !is_pixel_value(wide)) {
+                return token;
+            }
+            *out++ = static_cast<uint8_t>(wide);
+            next = q;
+        }
+        next = std::max(next, p + 64);
+    }
+
+    // The last bytes, one number at a time.
+    p = next;
+    const char* token = p;
+    int value;
+    while (parse_int(p, end, value)) {
+        if (!is_pixel_value(value)) {
+            return token;
+        }
+        *out++ = static_cast<uint8_t>(value);
+        token = p;
+    }
+    return p;
+}
+
+// "v " for every 8-bit value, padded to 4 bytes so a value is always copied
+// as one 4-byte store, with the length to advance by.
+struct DecimalTable {
+    char text[256][4];
+    uint8_t length[256];
+
+    DecimalTable() {
+        for (int v = 0; v < 256; v++) {
+            std::memset(text[v], ' ', 4);
+            int n = std::snprintf(text[v], 4, "%d", v);
+            text[v][n] = ' ';
+            length[v] = (uint8_t) (n + 1);
         }
     }
-    counter = 0;
-    for(int i = 1; i < height; i++) {
-        for(int j = 0; j <= i-1; j++) {
-            lower_triangular[counter] = image.get_pixel(i,j);
-            counter += 1;
+};
+
+static const DecimalTable& decimal_table() {
+    static const DecimalTable* table = new DecimalTable();
+    return *table;
+}
+
+// Writes values as text, each followed by a space except the last, which is
+// followed by a newline; an empty array writes just the newline. Rounds of
+// chunks are formatted in parallel into one buffer, then written in order.
+static void write_text_values(std::ofstream& out, const uint8_t* values, size_t count) {
+    if (count == 0) {
+        out.put('\n');
+        return;
+    }
+    const DecimalTable& table = decimal_table();
+    size_t chunks = (count + TEXT_FORMAT_CHUNK - 1) / TEXT_FORMAT_CHUNK;
+    size_t chunksPerRound = (size_t) std::max(1, TileExecutor::get_thread_count()) * 2;
+    std::vector<char> buffer(std::min(chunks, chunksPerRound) * TEXT_FORMAT_CHUNK * 4);
+    std::vector<size_t> lengths(chunksPerRound);
+    for (size_t round = 0; round < chunks; round += chunksPerRound) {
+        int tasks = (int) std::min(chunksPerRound, chunks - round);
+        TileExecutor::for_each_task(tasks, [&](int t) {
+            size_t begin = (round + t) * TEXT_FORMAT_CHUNK;
+            size_t end = std::min(begin + TEXT_FORMAT_CHUNK, count);
+            char* start = buffer.data() + (size_t) t * TEXT_FORMAT_CHUNK * 4;
+            char* p = start;
+            for (size_t i = begin; i < end; i++) {
+                std::memcpy(p, table.text[values[i]], 4);
+                p += table.length[values[i]];
+            }
+            if (end == count) {
+                p[-1] = '\n';
+            }
+            lengths[t] = (size_t) (p - start);
+        });
+        for (int t = 0; t < tasks; t++) {
+            out.write(buffer.data() + (size_t) t * TEXT_FORMAT_CHUNK * 4, (std::streamsize) lengths[t]);
         }
     }
 }
 
+// Number of elements in the upper triangular array (including the diagonal):
+// row i holds columns [i, w), i.e. max(0, w - i) pixels.
+size_t SecretImage::upper_size(int w, int h) {
+    size_t rows = (size_t) std::max(0, std::min(h, w));
+    return rows * w - rows * (rows - 1) / 2;
+}
+
+// Number of elements in the lower triangular array (excluding the diagonal):
+// row i holds columns [0, min(i, w)).
+size_t SecretImage::lower_size(int w, int h) {
+    if (h <= 0 || w <= 0) {
+        return 0;
+    }
+    if (h <= w) {
+        return (size_t) h * (h - 1) / 2;
+    }
+    return (size_t) w * (w - 1) / 2 + (size_t) (h - w) * w;
+}
+
+// Offset of pixel (row, row) in the upper array: rows before it hold width - i pixels each.
+// For row <= height these are also the array sizes of a row x width image.
+size_t SecretImage::upper_offset(int row) const {
+    size_t rows = (size_t) std::min(row, width);
+    return rows * width - rows * (rows - 1) / 2;
+}
+
+// Offset of pixel (row, 0) in the lower array: rows before it hold min(i, width) pixels each.
+size_t SecretImage::lower_offset(int row) const {
+    if (row <= width) {
+        return (size_t) row * (row - 1) / 2;
+    }
+    return (size_t) width * (width - 1) / 2 + (size_t) (row - width) * width;
+}
+
+// Allocates one zeroed block for both arrays from the buffer pool and points them into it.
+void SecretImage::allocate() {
+    size_t upperSize = upper_size(width, height);
+    size_t lowerSize = lower_size(width, height);
+    size_t bytes = upperSize + lowerSize;
+    std::shared_ptr<uint8_t> block(static_cast<uint8_t*>(BufferPool::acquire(bytes)),
+                                   [bytes](uint8_t* memory) { BufferPool::release(memory, bytes); });
+    if (bytes > 0) {
+        std::memset(block.get(), 0, bytes);
+    }
+    upper_triangular = block.get();
+    lower_triangular = block.get() + upperSize;
+    storage = block;
+}
+
+// Copies image row i into the arrays: columns [0, min(i, width)) go to the lower
+// array and the rest to the upper array, each as one contiguous run.
+void SecretImage::split_row(int i, const uint8_t* row) {
+    int split = std::min(i, width);
+    if (split > 0) {
+        std::memcpy(lower_triangular + lower_offset(i), row, split);
+    }
+    if (split < width) {
+        std::memcpy(upper_triangular + upper_offset(i), row + split, width - split);
+    }
+}
+
+// Copies image row i back out of the arrays.
+void SecretImage::join_row(int i, uint8_t* row) const {
+    int split = std::min(i, width);
+    if (split > 0) {
+        std::memcpy(row, lower_triangular + lower_offset(i), split);
+    }
+    if (split < width) {
+        std::memcpy(row + split, upper_triangular + upper_offset(i), width - split);
+    }
+}
+
+// Constructor: split image into upper and lower triangular arrays
+SecretImage::SecretImage(const GrayscaleImage& image) {
+    // 1. Allocate the memory for the upper and lower triangular matrices.
+    width = image.get_width();
+    height = image.get_height();
+    ScopedTimer timer("secret.split", (uint64_t) width * height, 2 * (uint64_t) width * height);
+    allocate();
+
+    // 2. Fill both matrices with the pixels from the GrayscaleImage. Every row
+    //    lands in its own place, so bands of rows are copied in parallel.
+    TileExecutor::for_each_band(height, 0, [&](const RowBand& band) {
+        for (int i = band.begin; i < band.end; i++) {
+            split_row(i, image.row(i));
+        }
+    });
+}
+
 // Constructor: instantiate based on data read from file
 SecretImage::SecretImage(int w, int h, int * upper, int * lower) {
-    // Since file reading part should dynamically allocate upper and lower matrices.
-    // You should simply copy the parameters to instance variables.
+    // Convert the int arrays to the 8-bit storage, then free them as their owner.
     width = w;
     height = h;
-    upper_triangular = upper;
-    lower_triangular = lower;
+    allocate();
+    std::copy(upper, upper + upper_size(w, h), upper_triangular);
+    std::copy(lower, lower + lower_size(w, h), lower_triangular);
+    delete[] upper;
+    delete[] lower;
+}
+
+// Constructor: wrap arrays kept alive by an existing owner
+SecretImage::SecretImage(int w, int h, uint8_t * upper, uint8_t * lower, std::shared_ptr<void> owner)
+    : upper_triangular(upper), lower_triangular(lower), width(w), height(h), storage(owner) {
+}
+
+// Copy constructor: a private copy of both arrays, even when other is file-backed
+SecretImage::SecretImage(const SecretImage& other) : width(other.width), height(other.height) {
+    allocate();
+    size_t upperSize = upper_size(width, height);
+    size_t lowerSize = lower_size(width, height);
+    Trace::count("bytes_copied", (int64_t) (upperSize + lowerSize));
+    if (upperSize > 0) {
+        std::memcpy(upper_triangular, other.upper_triangular, upperSize);
+    }
+    if (lowerSize > 0) {
+        std::memcpy(lower_triangular, other.lower_triangular, lowerSize);
+    }
+}
+
+// Move constructor: takes over the arrays, their storage and their int mirrors
+SecretImage::SecretImage(SecretImage&& other) noexcept
+    : upper_triangular(other.upper_triangular), lower_triangular(other.lower_triangular),
+      width(other.width), height(other.height), storage(std::move(other.storage)),
+      legacyUpper(std::move(other.legacyUpper)), legacyLower(std::move(other.legacyLower)) {
+    other.upper_triangular = nullptr;
+    other.lower_triangular = nullptr;
+    other.width = 0;
+    other.height = 0;
 }
 
+// Copy assignment
+SecretImage& SecretImage::operator=(const SecretImage& other) {
+    if (this != &other) {
+        SecretImage copy(other);
+        *this = std::move(copy);
+    }
+    return *this;
+}
+
+// Move assignment
+SecretImage& SecretImage::operator=(SecretImage&& other) noexcept {
+    if (this != &other) {
+        upper_triangular = other.upper_triangular;
+        lower_triangular = other.lower_triangular;
+        width = other.width;
+        height = other.height;
+        storage = std::move(other.storage);
+        legacyUpper = std::move(other.legacyUpper);
+        legacyLower = std::move(other.legacyLower);
+        other.upper_triangular = nullptr;
+        other.lower_triangular = nullptr;
+        other.width = 0;
+        other.height = 0;
+    }
+    return *this;
+}
 
-// Destructor: free the arrays
+// Destructor: the storage frees the arrays, or unmaps the file they live in.
 SecretImage::~SecretImage() {
-    // Simply free the dynamically allocated memory
-    // for the upper and lower triangular matrices.
-    delete[] upper_triangular;
-    delete[] lower_triangular;
 }
 
 // Reconstructs and returns the full image from upper and lower triangular matrices.
 GrayscaleImage SecretImage::reconstruct() const {
+    ScopedTimer timer("secret.reconstruct", (uint64_t) width * height, 2 * (uint64_t) width * height);
     GrayscaleImage image(width, height);
-    int counter = 0;
-    for(int i = 0; i < height; i++) {
-        for(int j = i; j < width; j++) {
-            image.set_pixel(i,j,upper_triangular[counter]);
-            counter ++;
-        }
-    }
-    int lcounter = 0;
-    for(int i = 1; i < height; i++) {
-        for(int j = 0; j < i; j++) {
-            image.set_pixel(i,j,lower_triangular[lcounter]);
-            lcounter ++;
+    TileExecutor::for_each_band(height, 0, [&](const RowBand& band) {
+        for (int i = band.begin; i < band.end; i++) {
+            join_row(i, image.row(i));
         }
-    }
+    });
     return image;
 }
 
 // Save the filtered image back to the triangular arrays
 void SecretImage::save_back(const GrayscaleImage& image) {
-    // Update the lower and upper triangular matrices 
+    // Update the lower and upper triangular matrices
     // based on the GrayscaleImage given as the parameter.
-    int lowerCounter = 0;
-    int upperCounter = 0;
-    for(int i = 0; i < height; i++) {
-        for(int j = 0; j < width; j++) {
-            if(i>j) {
-                lower_triangular[lowerCounter] = image.get_pixel(i,j);
-                lowerCounter += 1;
-            }else {
-                upper_triangular[upperCounter] = image.get_pixel(i,j);
-                upperCounter += 1;
-            }
-        }
+    if (image.get_width() != width || image.get_height() != height) {
+        throw std::invalid_argument("The image must have the secret image's dimensions.");
     }
+    ScopedTimer timer("secret.save_back", (uint64_t) width * height, 2 * (uint64_t) width * height);
+    TileExecutor::for_each_band(height, 0, [&](const RowBand& band) {
+        for (int i = band.begin; i < band.end; i++) {
+            split_row(i, image.row(i));
+        }
+    });
 }
 
 // Save the upper and lower triangular arrays to a file
-void SecretImage::save_to_file(const std::string& filename) {
-    std::ofstream outFile(filename);
-    // 1. Write width and height on the first line, separated by a single space.
-    outFile << width << " " << height << std::endl;
-
-    int sizeOfUpper = width * (width + 1) / 2;
-
-    // 2. Write the upper_triangular array to the second line.
-    // Ensure that the elements are space-separated.
-    // If there are 15 elements, write them as: "element1 element2 ... element15"
-    for(int i = 0; i < sizeOfUpper; i++) {
-        outFile << upper_triangular[i];
-        if(i != sizeOfUpper - 1) {
-            outFile << " ";
-        }
-    }
-    outFile << std::endl;
-    int sizeOfLower = width * (width - 1) / 2;
+void SecretImage::save_to_file(const std::string& filename, FileFormat format) {
+    ScopedTimer timer("secret.save", (uint64_t) width * height, (uint64_t) width * height);
+
+    // Write a temporary file next to the target and rename it over the target at
+    // the end. The arrays of a binary-loaded image live in the mapping of the file
+    // they came from, so opening that file for writing would truncate them while
+    // they are being written out.
+    ReplacementFile file(filename);
+    write_file(file.path(), format);
+    file.commit();
+}
 
-    // 3. Write the lower_triangular array to the third line in a similar manner
-    // as the second line.
-    for (size_t i = 0; i < sizeOfLower; i++) {
-        outFile << lower_triangular[i];
-        if (i != sizeOfLower - 1) {
-            outFile << " ";
+// Writes the arrays to filename in the given format.
+void SecretImage::write_file(const std::string& filename, FileFormat format) const {
+    if (format == BINARY) {
+        // Header first, then both arrays exactly as they sit in memory.
+        size_t upperSize = upper_size(width, height);
+        size_t lowerSize = lower_size(width, height);
+        SecretImageHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, BINARY_MAGIC, sizeof(BINARY_MAGIC));
+        header.version = BINARY_VERSION;
+        header.width = (uint32_t) width;
+        header.height = (uint32_t) height;
+        header.upperSize = upperSize;
+        header.lowerSize = lowerSize;
+        header.checksum = payload_checksum(upper_triangular, upperSize, lower_triangular, lowerSize);
+
+        std::ofstream outFile(filename, std::ios::binary);
+        outFile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        outFile.write(reinterpret_cast<const char*>(upper_triangular), upperSize);
+        outFile.write(reinterpret_cast<const char*>(lower_triangular), lowerSize);
+        if (!outFile) {
+            throw std::runtime_error("Could not write " + filename);
         }
+        return;
     }
-    outFile << std::endl;
 
-    outFile.close();
+    save_text(filename);
+}
 
+// Save the arrays in the text format: width and height on the first line, then
+// the upper and the lower array, space-separated, on one line each.
+void SecretImage::save_text(const std::string& filename) const {
+    std::ofstream outFile(filename);
+    outFile << width << " " << height << "\n";
+    write_text_values(outFile, upper_triangular, upper_size(width, height));
+    write_text_values(outFile, lower_triangular, lower_size(width, height));
+    if (!outFile) {
+        throw std::runtime_error("Could not write " + filename);
+    }
 }
 
-// Static function to load a SecretImage from a file
-SecretImage SecretImage::load_from_file(const std::string& filename) {
-    // 1. Open the file and read width and height from the first line, separated by a space.
-    std::ifstream inFile(filename);
-    int width;
-    int height;
-    inFile >> width >> height;
+// Maps a binary secret image and points the arrays straight into the mapping.
+SecretImage SecretImage::load_binary(const std::shared_ptr<MappedFile>& file, const std::string& filename) {
+    if (file->size() < sizeof(SecretImageHeader)) {
+        throw std::runtime_error("Truncated secret image header in " + filename);
+    }
+    SecretImageHeader header;
+    std::memcpy(&header, file->data(), sizeof(header));
+    if (header.version != BINARY_VERSION) {
+        throw std::runtime_error("Unsupported secret image version in " + filename);
+    }
 
-    // 2. Calculate the sizes of the upper and lower triangular arrays.
-    int upperSize = (height + 1 ) * height/2 ;
-    int lowerSize = (height - 1) * height/2 ;
+    // 1. The dimensions must fit an int, and the sizes must agree with them and
+    //    with the file length.
+    if (header.width > (uint32_t) INT_MAX || header.height > (uint32_t) INT_MAX) {
+        throw std::runtime_error("Inconsistent secret image sizes in " + filename);
+    }
+    int width = (int) header.width;
+    int height = (int) header.height;
+    if (header.upperSize != upper_size(width, height) || header.lowerSize != lower_size(width, height) ||
+        file->size() - sizeof(header) < header.upperSize + header.lowerSize) {
+        throw std::runtime_error("Inconsistent secret image sizes in " + filename);
+    }
+
+    // 2. Verify the payload before handing it out.
+    uint8_t* upper = file->data() + sizeof(header);
+    uint8_t* lower = upper + header.upperSize;
+    uint64_t checksum = payload_checksum(upper, header.upperSize, lower, header.lowerSize);
+    if (checksum != header.checksum) {
+        throw std::runtime_error("Checksum mismatch in " + filename);
+    }
+    return SecretImage(width, height, upper, lower, file);
+}
+
+// Parses the text format from the mapping. The header is read first; the rest
+// of the text is cut into chunks that end on whitespace, each chunk is parsed
+// on its own thread into a buffer of its values, and the buffers are copied
+// into place once the prefix sums of their counts give each one's offset.
+SecretImage SecretImage::load_text(const MappedFile& file, const std::string& filename) {
+    const char* text = reinterpret_cast<const char*>(file.data());
+    const char* end = text + file.size();
 
-    // 3. Allocate memory for both arrays.
-    int* upper_triangular = new int[upperSize];
-    int* lower_triangular = new int[lowerSize];
+    // 1. Width and height.
+    int width, height;
+    const char* p = text;
+    if (!parse_int(p, end, width) || !parse_int(p, end, height) || width < 0 || height < 0) {
+        throw std::runtime_error("Malformed secret image header in " + filename);
+    }
 
-    // 4. Read the upper_triangular array from the second line, space-separated.
-    for(int i = 0; i < upperSize; i++) {
-        inFile >> upper_triangular[i];
+    // 2. Chunk boundaries, each moved forward to the next whitespace so that no
+    //    number is split; a number straddling a cut belongs to the chunk before.
+    size_t bodySize = (size_t) (end - p);
+    size_t chunks = std::max<size_t>(1, (bodySize + TEXT_PARSE_CHUNK - 1) / TEXT_PARSE_CHUNK);
+    std::vector<const char*> cuts(chunks + 1);
+    cuts[0] = p;
+    for (size_t c = 1; c < chunks; c++) {
+        const char* cut = std::max(cuts[c - 1], p + c * TEXT_PARSE_CHUNK);
+        while (cut < end && !is_space(*cut)) {
+            cut++;
+        }
+        cuts[c] = cut;
     }
+    cuts[chunks] = end;
 
-    // 5. Read the lower_triangular array from the third line, space-separated.
-    for(int i = 0; i < lowerSize; i++) {
-        inFile >> lower_triangular[i];
+    // 3. Parse the chunks in parallel. Every value takes at least two bytes with
+    //    its separator, so a chunk of n bytes holds at most n / 2 + 1 of them.
+    std::vector<std::vector<uint8_t> > values(chunks);
+    std::vector<size_t> counts(chunks, 0);
+    std::vector<uint8_t> malformed(chunks, 0);
+    TileExecutor::for_each_task((int) chunks, [&](int c) {
+        const char* q = cuts[c];
+        const char* chunkEnd = cuts[c + 1];
+        values[c].resize((size_t) (chunkEnd - q) / 2 + 1);
+        uint8_t* out = values[c].data();
+        malformed[c] = parse_values(q, chunkEnd, out) != chunkEnd;
+        counts[c] = (size_t) (out - values[c].data());
+    });
+
+    // 4. The values fill the upper array and then the lower one, which allocate()
+    //    places right after it. Anything that is not a value in 0-255, and any
+    //    value past the lower array, makes the file malformed.
+    SecretImage secret_image(width, height, nullptr, nullptr, std::shared_ptr<void>());
+    secret_image.allocate();
+    size_t needed = upper_size(width, height) + lower_size(width, height);
+    std::vector<size_t> offsets(chunks + 1, 0);
+    for (size_t c = 0; c < chunks; c++) {
+        if (malformed[c]) {
+            throw std::runtime_error("Malformed secret image data in " + filename);
+        }
+        offsets[c + 1] = offsets[c] + counts[c];
+    }
+    if (offsets[chunks] < needed) {
+        throw std::runtime_error("Truncated secret image data in " + filename);
+    }
+    if (offsets[chunks] > needed) {
+        throw std::runtime_error("Malformed secret image data in " + filename);
     }
+    uint8_t* destination = secret_image.upper_triangular;
+    TileExecutor::for_each_task((int) chunks, [&](int c) {
+        std::memcpy(destination + offsets[c], values[c].data(), counts[c]);
+    });
+    return secret_image;
+}
+
+// Static function to load a SecretImage from a file
+SecretImage SecretImage::load_from_file(const std::string& filename) {
+    ScopedTimer timer("secret.load");
+    // 1. Map the file and check whether it starts with the binary magic.
+    std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(filename);
+    bool binary = file->size() >= sizeof(BINARY_MAGIC) &&
+                  std::memcmp(file->data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0;
 
-    // 6. Close the file and return a SecretImage object initialized with the
-    //    width, height, and triangular arrays.
-    inFile.close();
-    SecretImage secret_image(width,height,upper_triangular,lower_triangular);
+    // 2. Binary images keep the mapping; text is parsed out of it.
+    SecretImage secret_image = binary ? load_binary(file, filename) : load_text(*file, filename);
+    timer.set_pixels((uint64_t) secret_image.width * secret_image.height);
+    timer.set_bytes(binary ? (uint64_t) secret_image.width * secret_image.height : (uint64_t) file->size());
     return secret_image;
 }
 
 // Returns a pointer to the upper triangular part of the secret image.
-int * SecretImage::get_upper_triangular() const {
+uint8_t * SecretImage::get_upper_bytes() const {
     return upper_triangular;
 }
 
 // Returns a pointer to the lower triangular part of the secret image.
-int * SecretImage::get_lower_triangular() const {
+uint8_t * SecretImage::get_lower_bytes() const {
     return lower_triangular;
 }
 
+// Copies the values into the int mirror under the lock.
+int * SecretImage::refresh_mirror(std::unique_ptr<int[]>& mirror, const uint8_t* values, size_t count) const {
+    std::lock_guard<std::mutex> lock(legacyMutex);
+    if (!mirror) {
+        mirror.reset(new int[count > 0 ? count : 1]());
+    }
+    refresh_int_mirror(mirror.get(), values, count);
+    return mirror.get();
+}
+
+// Returns an int copy of the upper triangular part, as the getter used to.
+const int * SecretImage::get_upper_triangular() const {
+    return refresh_mirror(legacyUpper, upper_triangular, upper_size(width, height));
+}
+
+// Returns an int copy of the lower triangular part, as the getter used to.
+const int * SecretImage::get_lower_triangular() const {
+    return refresh_mirror(legacyLower, lower_triangular, lower_size(width, height));
+}
+
 // Returns the width of the secret image.
 int SecretImage::get_width() const {
     return width;
@@ -8,23 +8,65 @@
 #include <sstream>
 #include <string>
 #include <limits>
+#include <memory>
+#include <mutex>
+#include <cstdint>
 
 #include "GrayscaleImage.h"
 
+class MappedFile;
+
 class SecretImage {
-    
+
 private:
-    int *upper_triangular; // Array for upper triangular part (including diagonal)
-    int *lower_triangular; // Array for lower triangular part (excluding diagonal)
+    uint8_t *upper_triangular; // Array for upper triangular part (including diagonal)
+    uint8_t *lower_triangular; // Array for lower triangular part (excluding diagonal)
     int width, height;
 
+    // Keeps the memory behind both arrays alive: a pool block, or the file mapping
+    // of a binary secret image.
+    std::shared_ptr<void> storage;
+
+    // int copies of the arrays handed out by the legacy getters, built on demand.
+    mutable std::unique_ptr<int[]> legacyUpper, legacyLower;
+    mutable std::mutex legacyMutex;
+
+    // Allocates one block holding both arrays.
+    void allocate();
+
+    // Copy one image row into the arrays and back, as at most two memcpy runs.
+    void split_row(int i, const uint8_t *row);
+    void join_row(int i, uint8_t *row) const;
+
+    // Brings mirror up to date with count values, allocating it on first use.
+    int *refresh_mirror(std::unique_ptr<int[]> &mirror, const uint8_t *values, size_t count) const;
+
+    // Load the two formats from a mapping of the whole file. The binary arrays
+    // point straight into the mapping; the text is parsed in parallel chunks.
+    static SecretImage load_binary(const std::shared_ptr<MappedFile> &file, const std::string &filename);
+    static SecretImage load_text(const MappedFile &file, const std::string &filename);
+
 public:
+    // On-disk formats. TEXT is the original space-separated format; BINARY is a
+    // versioned header followed by the packed 8-bit arrays, loaded through mmap.
+    enum FileFormat { TEXT, BINARY };
+
     // Constructor: takes a GrayscaleImage and splits it into two triangular arrays
     SecretImage(const GrayscaleImage &image);
 
-    // Constructor: instantiate based on data read from file
+    // Constructor: instantiate based on data read from file. Takes ownership of the
+    // new[]-allocated int arrays, which are converted to 8-bit storage and freed.
     SecretImage(int w, int h, int *upper, int *lower);
 
+    // Constructor: wraps arrays whose memory is kept alive by owner.
+    SecretImage(int w, int h, uint8_t *upper, uint8_t *lower, std::shared_ptr<void> owner);
+
+    // Copies get their own arrays; moves take the arrays over and leave other empty.
+    SecretImage(const SecretImage &other);
+    SecretImage(SecretImage &&other) noexcept;
+    SecretImage &operator=(const SecretImage &other);
+    SecretImage &operator=(SecretImage &&other) noexcept;
+
     // Destructor
     ~SecretImage();
 
@@ -34,17 +76,80 @@ public:
     // Save back to triangular arrays after filtering
     void save_back(const GrayscaleImage &image);
 
-    // Saves a secret image into the given file
-    void save_to_file(const std::string &filename);
+    // Saves a secret image into the given file, through a temporary file renamed
+    // over it, so saving an image back to the file it was loaded from is safe. An
+    // existing file keeps its permission bits, and a symlink keeps pointing at the
+    // saved file. Throws std::runtime_error if the file cannot be written.
+    void save_to_file(const std::string &filename, FileFormat format = TEXT);
 
-    // Reads a secret image from the given file
+    // Reads a secret image from the given file, detecting its format. Throws
+    // std::runtime_error if the file cannot be read or is malformed, which for
+    // the text format includes a value outside 0-255 or anything after the lower
+    // array.
     static SecretImage load_from_file(const std::string &filename);
 
+    // Number of elements in the upper and lower triangular arrays of a w x h image.
+    // Any rectangle works: row i keeps columns [i, w) in the upper array and
+    // columns [0, min(i, w)) in the lower one.
+    static size_t upper_size(int w, int h);
+    static size_t lower_size(int w, int h);
+
+    // Index mapping. Row i stores columns [0, i) in the lower array, starting at
+    // lower_offset(i), and columns [i, width) in the upper array, starting at
+    // upper_offset(i); both runs are contiguous.
+    size_t upper_offset(int row) const;
+    size_t lower_offset(int row) const;
+
+    // Address of pixel (row, col) inside the triangular arrays.
+    uint8_t *pixel_address(int row, int col) const {
+        return col < row ? lower_triangular + lower_offset(row) + col
+                         : upper_triangular + upper_offset(row) + (col - row);
+    }
+
+    // Calls fn(uint8_t* run, size_t length) for every contiguous run of the arrays
+    // that holds the row-major pixel range [begin, end), in order. Each image row
+    // contributes at most two runs, so the cost depends only on the range.
+    template <typename Fn>
+    void for_each_run(size_t begin, size_t end, Fn fn) const {
+        if (width <= 0 || begin >= end) {
+            return;
+        }
+        for (size_t index = begin; index < end;) {
+            int row = (int) (index / width);
+            int col = (int) (index % width);
+            int colEnd = (int) std::min<size_t>(width, col + (end - index));
+            int split = std::min(std::max(row, col), colEnd);
+            if (col < split) {
+                fn(lower_triangular + lower_offset(row) + col, (size_t) (split - col));
+            }
+            if (split < colEnd) {
+                fn(upper_triangular + upper_offset(row) + (split - row), (size_t) (colEnd - split));
+            }
+            index += colEnd - col;
+        }
+    }
+
+    // The triangular arrays themselves, 8 bits per value.
+    uint8_t *get_upper_bytes() const;
+    uint8_t *get_lower_bytes() const;
+
+    // Compatibility shims: read-only int copies of the arrays, owned by the image
+    // and refreshed on every call. To change values use get_upper_bytes() and
+    // get_lower_bytes(). Safe to call from several threads on an image nobody is
+    // modifying; a refresh after an edit races with readers of the pointer an
+    // earlier call returned.
+    const int *get_upper_triangular() const;
+    const int *get_lower_triangular() const;
+
     // Getters and setters for private instance variables
-    int *get_upper_triangular() const;
-    int *get_lower_triangular() const;
     int get_width() const;
     int get_height() const;
+
+private:
+    // Writes the file save_to_file renames into place; the text format goes
+    // through large buffers formatted in parallel.
+    void write_file(const std::string &filename, FileFormat format) const;
+    void save_text(const std::string &filename) const;
 };
 
 #endif // SECRET_IMAGE_H
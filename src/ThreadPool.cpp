@@ -0,0 +1,99 @@
+#include "ThreadPool.h"
+
+// Set on pool threads, and on any thread while it runs a task, so nested runs stay serial.
+static thread_local bool insideTask = false;
+
+ThreadPool::ThreadPool(int threadCount)
+    : task(nullptr), taskCount(0), nextIndex(0), pendingWorkers(0), generation(0), stopping(false) {
+    for (int i = 1; i < threadCount; i++) {
+        workers.push_back(std::thread(&ThreadPool::worker_loop, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (size_t i = 0; i < workers.size(); i++) {
+        workers[i].join();
+    }
+}
+
+// Claims task indices until none are left.
+void ThreadPool::drain() {
+    bool wasInside = insideTask;
+    insideTask = true;
+    for (int i = nextIndex.fetch_add(1); i < taskCount; i = nextIndex.fetch_add(1)) {
+        try {
+            (*task)(i);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!error) {
+                error = std::current_exception();
+            }
+            nextIndex = taskCount;
+        }
+    }
+    insideTask = wasInside;
+}
+
+void ThreadPool::worker_loop() {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            while (!stopping && generation == seen) {
+                wake.wait(lock);
+            }
+            if (stopping) {
+                return;
+            }
+            seen = generation;
+        }
+        drain();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingWorkers--;
+        }
+        done.notify_one();
+    }
+}
+
+void ThreadPool::run(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) {
+        return;
+    }
+    if (workers.empty() || count == 1 || insideTask) {
+        for (int i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &fn;
+        taskCount = count;
+        nextIndex = 0;
+        error = nullptr;
+        pendingWorkers = (int) workers.size();
+        generation++;
+    }
+    wake.notify_all();
+
+    // The caller works too, then waits for every worker to leave the task.
+    drain();
+    std::unique_lock<std::mutex> lock(mutex);
+    while (pendingWorkers > 0) {
+        done.wait(lock);
+    }
+    task = nullptr;
+    if (error) {
+        std::exception_ptr thrown = error;
+        error = nullptr;
+        std::rethrow_exception(thrown);
+    }
+}
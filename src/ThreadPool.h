@@ -0,0 +1,49 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads that run indexed tasks in parallel.
+class ThreadPool {
+private:
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::mutex runMutex;                 // One run() at a time per pool
+
+    const std::function<void(int)>* task; // Task of the current run, if any
+    int taskCount;
+    std::atomic<int> nextIndex;
+    int pendingWorkers;
+    unsigned long generation;
+    bool stopping;
+    std::exception_ptr error;            // First exception thrown by the current run
+
+    void worker_loop();
+    void drain();
+
+public:
+    // Creates a pool that runs tasks on threadCount threads in total, the calling
+    // thread included; a count of 1 runs everything on the caller.
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    int get_thread_count() const { return (int) workers.size() + 1; }
+
+    // Runs task(i) for every i in [0, count) and returns once all of them finished.
+    // Calls made from inside a task run serially on the calling thread. If a task
+    // throws, the remaining indices are skipped and the first exception is rethrown.
+    void run(int count, const std::function<void(int)>& task);
+};
+
+#endif // THREAD_POOL_H
@@ -0,0 +1,94 @@
+#include "TileExecutor.h"
+#include "ThreadPool.h"
+#include "Trace.h"
+#include <algorithm>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Bands are never thinner than this, nor thinner than twice the kernel radius,
+// so the halo rows each band recomputes stay a small share of its work.
+static const int MIN_BAND_HEIGHT = 16;
+
+// Bands handed out per thread, so uneven bands still balance out.
+static const int BANDS_PER_THREAD = 4;
+
+static std::mutex poolMutex;
+static std::shared_ptr<ThreadPool> sharedPool;
+
+static int default_thread_count() {
+    const char* env = std::getenv("CLEARVISION_THREADS");
+    if (env != nullptr && std::atoi(env) > 0) {
+        return std::atoi(env);
+    }
+    unsigned int hardware = std::thread::hardware_concurrency();
+    return hardware > 0 ? (int) hardware : 1;
+}
+
+// Returns the shared pool, creating it on first use. Callers keep their own
+// reference, so resizing the pool never pulls it from under a running filter.
+static std::shared_ptr<ThreadPool> acquire_pool() {
+    std::lock_guard<std::mutex> lock(poolMutex);
+    if (!sharedPool) {
+        sharedPool = std::make_shared<ThreadPool>(default_thread_count());
+    }
+    return sharedPool;
+}
+
+// Splits [0, height) into bands sized for the given thread count and radius.
+static std::vector<RowBand> make_bands(int height, int radius, int threads) {
+    std::vector<RowBand> bands;
+    int minHeight = std::max(MIN_BAND_HEIGHT, 2 * radius);
+    int count = std::max(1, std::min(threads * BANDS_PER_THREAD, height / minHeight));
+    if (threads <= 1) {
+        count = 1;
+    }
+    for (int b = 0; b < count; b++) {
+        RowBand band;
+        band.begin = (int) ((long long) height * b / count);
+        band.end = (int) ((long long) height * (b + 1) / count);
+        band.haloBegin = std::max(0, band.begin - radius);
+        band.haloEnd = std::min(height, band.end + radius);
+        bands.push_back(band);
+    }
+    return bands;
+}
+
+void TileExecutor::for_each_band(int height, int radius, const std::function<void(const RowBand&)>& fn) {
+    for_each_plane_band(1, height, radius, [&](int, const RowBand& band) {
+        fn(band);
+    });
+}
+
+void TileExecutor::for_each_plane_band(int planes, int height, int radius,
+                                       const std::function<void(int, const RowBand&)>& fn) {
+    if (planes <= 0 || height <= 0) {
+        return;
+    }
+    std::shared_ptr<ThreadPool> pool = acquire_pool();
+    std::vector<RowBand> bands = make_bands(height, radius, pool->get_thread_count());
+    int count = (int) bands.size();
+    pool->run(planes * count, [&](int index) {
+        ScopedTimer timer("tile.band");
+        fn(index / count, bands[index % count]);
+    });
+}
+
+void TileExecutor::for_each_task(int count, const std::function<void(int)>& fn) {
+    if (count <= 0) {
+        return;
+    }
+    acquire_pool()->run(count, fn);
+}
+
+void TileExecutor::set_thread_count(int threads) {
+    std::shared_ptr<ThreadPool> pool = std::make_shared<ThreadPool>(std::max(1, threads));
+    std::lock_guard<std::mutex> lock(poolMutex);
+    sharedPool = pool;
+}
+
+int TileExecutor::get_thread_count() {
+    return acquire_pool()->get_thread_count();
+}
@@ -0,0 +1,35 @@
+#ifndef TILE_EXECUTOR_H
+#define TILE_EXECUTOR_H
+
+#include <functional>
+
+// A band of output rows plus the input rows its kernel reads around it.
+struct RowBand {
+    int begin, end;          // Output rows [begin, end)
+    int haloBegin, haloEnd;  // Input rows [haloBegin, haloEnd), clamped to the image
+};
+
+class TileExecutor {
+public:
+    // Splits `height` rows into bands with `radius` rows of halo on each side and
+    // runs fn on every band using the shared thread pool. Bands never overlap in
+    // their output rows, so fn may write its rows without synchronization.
+    static void for_each_band(int height, int radius, const std::function<void(const RowBand&)>& fn);
+
+    // The same over `planes` images of the same height, e.g. the channels of a
+    // color image: every band of every plane is one task of a single dispatch,
+    // so the planes run side by side instead of one full pass after another.
+    static void for_each_plane_band(int planes, int height, int radius,
+                                    const std::function<void(int, const RowBand&)>& fn);
+
+    // Runs fn(i) for every i in [0, count) on the shared pool, for work that is
+    // already split some other way, e.g. independent image regions.
+    static void for_each_task(int count, const std::function<void(int)>& fn);
+
+    // Number of threads used by the shared pool. The default comes from the
+    // CLEARVISION_THREADS environment variable, else the hardware concurrency.
+    static void set_thread_count(int threads);
+    static int get_thread_count();
+};
+
+#endif // TILE_EXECUTOR_H
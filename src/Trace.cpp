@@ -0,0 +1,234 @@
+#include "Trace.h"
+#include "BufferPool.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+
+// One span as it appears in the Chrome trace.
+struct TraceEvent {
+    std::string name;       // A copy, so callers may pass a temporary's c_str()
+    int thread;
+    int64_t startNs, durationNs;
+    uint64_t pixels, bytes;
+};
+
+struct TraceState {
+    std::mutex mutex;
+    std::map<std::string, TraceSpanStats> spans;
+    std::map<std::string, int64_t> counters;
+    std::vector<TraceEvent> events;
+    uint64_t droppedEvents;
+    int64_t origin;        // Trace timestamps count from here
+
+    TraceState() : droppedEvents(0), origin(Trace::now_ns()) {}
+};
+
+// Never destroyed, so spans recorded by threads still running at exit, and the
+// exit-time dump, find it intact.
+static TraceState& trace_state() {
+    static TraceState* state = new TraceState();
+    return *state;
+}
+
+// Small per-thread numbers for the trace, in order of first use.
+static int thread_number() {
+    static std::atomic<int> nextThread(1);
+    thread_local int number = nextThread++;
+    return number;
+}
+
+static std::string json_string(const std::string& text) {
+    std::string out = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if ((unsigned char) c < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out += c;
+        }
+    }
+    return out + "\"";
+}
+
+// With CLEARVISION_TRACE set to a path prefix, both reports are written at exit.
+static std::string exitPrefix;
+
+static void write_at_exit() {
+    Trace::write_json(exitPrefix + ".json");
+    Trace::write_chrome_trace(exitPrefix + ".trace.json");
+}
+
+static bool enabled_from_environment() {
+    const char* env = std::getenv("CLEARVISION_TRACE");
+    if (env == nullptr || *env == '\0' || std::string(env) == "0") {
+        return false;
+    }
+    if (std::string(env) != "1") {
+        exitPrefix = env;
+        std::atexit(write_at_exit);
+    }
+    return true;
+}
+
+std::atomic<bool> Trace::enabled(enabled_from_environment());
+
+void Trace::set_enabled(bool on) {
+    enabled = on;
+}
+
+int64_t Trace::now_ns() {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Trace::record(const char* name, int64_t startNs, int64_t endNs, uint64_t pixels, uint64_t bytes) {
+    int thread = thread_number();
+    double ms = (endNs - startNs) / 1e6;
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+
+    // 1. Fold the span into its name's aggregate.
+    std::map<std::string, TraceSpanStats>::iterator it = state.spans.find(name);
+    if (it == state.spans.end()) {
+        TraceSpanStats stats = { name, 0, 0.0, ms, ms, 0, 0 };
+        it = state.spans.insert(std::make_pair(std::string(name), stats)).first;
+    }
+    TraceSpanStats& stats = it->second;
+    stats.count++;
+    stats.totalMs += ms;
+    stats.minMs = std::min(stats.minMs, ms);
+    stats.maxMs = std::max(stats.maxMs, ms);
+    stats.pixels += pixels;
+    stats.bytes += bytes;
+
+    // 2. Keep the event itself while there is room.
+    if (state.events.size() < MAX_EVENTS) {
+        TraceEvent event = { name, thread, startNs, endNs - startNs, pixels, bytes };
+        state.events.push_back(event);
+    } else {
+        state.droppedEvents++;
+    }
+}
+
+void Trace::add_to_counter(const char* name, int64_t value) {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.counters[name] += value;
+}
+
+std::vector<TraceSpanStats> Trace::spans() {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    std::vector<TraceSpanStats> result;
+    for (std::map<std::string, TraceSpanStats>::const_iterator it = state.spans.begin(); it != state.spans.end(); ++it) {
+        result.push_back(it->second);
+    }
+    return result;
+}
+
+std::map<std::string, int64_t> Trace::counters() {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    return state.counters;
+}
+
+std::string Trace::to_json() {
+    std::vector<TraceSpanStats> spanStats = spans();
+    std::map<std::string, int64_t> counterValues = counters();
+    uint64_t dropped;
+    {
+        TraceState& state = trace_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        dropped = state.droppedEvents;
+    }
+    BufferPoolStats pool = BufferPool::stats();
+
+    std::ostringstream out;
+    out << "{\n  \"spans\": [";
+    for (size_t i = 0; i < spanStats.size(); i++) {
+        const TraceSpanStats& stats = spanStats[i];
+        out << (i > 0 ? ",\n" : "\n")
+            << "    {\"name\": " << json_string(stats.name)
+            << ", \"count\": " << stats.count
+            << ", \"total_ms\": " << stats.totalMs
+            << ", \"min_ms\": " << stats.minMs
+            << ", \"max_ms\": " << stats.maxMs
+            << ", \"pixels\": " << stats.pixels
+            << ", \"bytes\": " << stats.bytes
+            << ", \"pixels_per_second\": " << stats.pixels_per_second() << "}";
+    }
+    out << "\n  ],\n  \"counters\": {";
+    size_t index = 0;
+    for (std::map<std::string, int64_t>::const_iterator it = counterValues.begin(); it != counterValues.end(); ++it) {
+        out << (index++ > 0 ? ", " : "") << json_string(it->first) << ": " << it->second;
+    }
+    out << "},\n  \"buffer_pool\": {\"live_bytes\": " << pool.liveBytes
+        << ", \"peak_bytes\": " << pool.peakBytes
+        << ", \"cached_bytes\": " << pool.cachedBytes
+        << ", \"acquisitions\": " << pool.acquisitions
+        << ", \"allocations\": " << pool.acquisitions - pool.hits
+        << ", \"hit_rate\": " << pool.hit_rate() << "},\n"
+        << "  \"dropped_events\": " << dropped << "\n}\n";
+    return out.str();
+}
+
+bool Trace::write_json(const std::string& filename) {
+    std::ofstream out(filename);
+    out << to_json();
+    return (bool) out;
+}
+
+bool Trace::write_chrome_trace(const std::string& filename) {
+    std::vector<TraceEvent> events;
+    std::map<std::string, int64_t> counterValues;
+    int64_t origin;
+    {
+        TraceState& state = trace_state();
+        std::lock_guard<std::mutex> lock(state.mutex);
+        events = state.events;
+        counterValues = state.counters;
+        origin = state.origin;
+    }
+
+    // Complete ("X") events in microseconds, then the counters' final values.
+    std::ofstream out(filename);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    int64_t lastNs = origin;
+    char timing[64];
+    for (size_t i = 0; i < events.size(); i++) {
+        const TraceEvent& event = events[i];
+        std::snprintf(timing, sizeof(timing), "\"ts\": %.3f, \"dur\": %.3f",
+                      (event.startNs - origin) / 1e3, event.durationNs / 1e3);
+        out << (i > 0 ? ",\n" : "\n")
+            << "{\"name\": " << json_string(event.name) << ", \"cat\": \"clearvision\", \"ph\": \"X\", "
+            << timing << ", \"pid\": 1, \"tid\": " << event.thread
+            << ", \"args\": {\"pixels\": " << event.pixels << ", \"bytes\": " << event.bytes << "}}";
+        lastNs = std::max(lastNs, event.startNs + event.durationNs);
+    }
+    for (std::map<std::string, int64_t>::const_iterator it = counterValues.begin(); it != counterValues.end(); ++it) {
+        std::snprintf(timing, sizeof(timing), "\"ts\": %.3f", (lastNs - origin) / 1e3);
+        out << (events.empty() && it == counterValues.begin() ? "\n" : ",\n")
+            << "{\"name\": " << json_string(it->first) << ", \"ph\": \"C\", " << timing
+            << ", \"pid\": 1, \"args\": {\"value\": " << it->second << "}}";
+    }
+    out << "\n]}\n";
+    return (bool) out;
+}
+
+void Trace::reset() {
+    TraceState& state = trace_state();
+    std::lock_guard<std::mutex> lock(state.mutex);
+    state.spans.clear();
+    state.counters.clear();
+    state.events.clear();
+    state.droppedEvents = 0;
+    state.origin = now_ns();
+}
@@ -0,0 +1,105 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+
+// Aggregated timings of every span recorded under one name.
+struct TraceSpanStats {
+    std::string name;
+    uint64_t count;
+    double totalMs, minMs, maxMs;
+    uint64_t pixels;   // Pixels the spans processed, where they say
+    uint64_t bytes;    // Bytes they read or wrote, where they say
+
+    double pixels_per_second() const { return totalMs > 0 ? pixels / (totalMs / 1000.0) : 0; }
+};
+
+// Process-wide timing and counters for the hot paths: image decode and encode,
+// every filter and its stages, secret image and crypto work, and the batch
+// stages. Spans are aggregated per name and, up to MAX_EVENTS, kept individually
+// for a Chrome trace (chrome://tracing, Perfetto).
+//
+// Tracing is off unless set_enabled(true) is called or the CLEARVISION_TRACE
+// environment variable is set. A value other than "1" is taken as a path prefix:
+// PREFIX.json and PREFIX.trace.json are written when the process exits. While
+// disabled a span costs one relaxed atomic load; building with
+// CLEARVISION_NO_TRACE compiles the spans out altogether.
+class Trace {
+private:
+    static std::atomic<bool> enabled;
+
+public:
+    // Individual events kept for the Chrome trace; later ones are only aggregated.
+    static const size_t MAX_EVENTS = 1 << 20;
+
+#ifdef CLEARVISION_NO_TRACE
+    static bool is_enabled() { return false; }
+#else
+    static bool is_enabled() { return enabled.load(std::memory_order_relaxed); }
+#endif
+    static void set_enabled(bool on);
+
+    // Monotonic clock, in nanoseconds.
+    static int64_t now_ns();
+
+    // Records one finished span; name is copied. Prefer ScopedTimer.
+    static void record(const char* name, int64_t startNs, int64_t endNs, uint64_t pixels, uint64_t bytes);
+
+    // Adds value to the named counter, e.g. "bytes_copied".
+    static void count(const char* name, int64_t value) {
+        if (is_enabled()) {
+            add_to_counter(name, value);
+        }
+    }
+    static void add_to_counter(const char* name, int64_t value);
+
+    // Snapshots of the aggregates, sorted by name.
+    static std::vector<TraceSpanStats> spans();
+    static std::map<std::string, int64_t> counters();
+
+    // Spans, counters and the BufferPool statistics as one JSON object.
+    static std::string to_json();
+
+    // Write to_json(), or the recorded events in Chrome trace-event format.
+    // Return false if the file could not be written.
+    static bool write_json(const std::string& filename);
+    static bool write_chrome_trace(const std::string& filename);
+
+    // Drops every aggregate, counter and event.
+    static void reset();
+};
+
+// Times the enclosing scope as one span. pixels and bytes may be given up front
+// or set before the scope ends, e.g. once a decoder knows the image size.
+class ScopedTimer {
+private:
+    const char* name;   // nullptr while tracing is disabled
+    int64_t start;
+    uint64_t pixels, bytes;
+
+public:
+    explicit ScopedTimer(const char* name, uint64_t pixels = 0, uint64_t bytes = 0)
+        : name(Trace::is_enabled() ? name : nullptr), start(0), pixels(pixels), bytes(bytes) {
+        if (this->name != nullptr) {
+            start = Trace::now_ns();
+        }
+    }
+
+    ~ScopedTimer() {
+        if (name != nullptr) {
+            Trace::record(name, start, Trace::now_ns(), pixels, bytes);
+        }
+    }
+
+    ScopedTimer(const ScopedTimer&) = delete;
+    ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+    void set_pixels(uint64_t count) { pixels = count; }
+    void set_bytes(uint64_t count) { bytes = count; }
+};
+
+#endif // TRACE_H